@@ -1,8 +1,14 @@
+#include <core/film.h>
 #include <util/fileio.h>
 #include <util/huffman.h>
+#include <util/imagemetrics.h>
 
 using namespace pine;
 
+static bool IsOption(const pstd::string& arg) {
+    return arg.size() >= 2 && arg[0] == '-' && arg[1] == '-';
+}
+
 size_t MaxLength(const pstd::vector<pstd::string>& names) {
     size_t maxLen = 0;
     for (auto& name : names)
@@ -54,13 +60,31 @@ static void Compress(pstd::string from, pstd::string to) {
 }
 
 static void Decompress(pstd::string from, pstd::string to) {
-    auto serialized = ReadBinaryData(from);
-    auto [tree, encoded] = Unarchive<HuffmanTree<uint8_t>, HuffmanEncoded>(serialized);
+    Deserializer deserializer(ReadBinaryData(from));
+    auto tree = deserializer.Unarchive<HuffmanTree<uint8_t>>();
+    auto encoded = deserializer.Unarchive<HuffmanEncoded>();
     auto input = HuffmanDecode<pstd::vector<uint8_t>>(tree, encoded);
 
     WriteBinaryData(to, input.data(), sizeof(input[0]) * input.size());
 }
 
+static void Merge(pstd::string to, const pstd::vector<pstd::string>& from) {
+    pstd::vector<FilmShard> shards;
+    for (auto& filename : from)
+        shards.push_back(Deserialize<FilmShard>(filename));
+    LOG("& shards      ======>      &", shards.size(), to);
+    MergeFilmShards(shards, to);
+    FlushImageWrites();
+}
+
+static void Compare(pstd::string reference, const pstd::vector<pstd::string>& filenames) {
+    size_t maxLen = MaxLength(filenames);
+    for (auto& filename : filenames)
+        if (auto error = CompareImages(filename, reference))
+            LOG("&  MSE &.6  relMSE &.6  SSIM &.4", Format(maxLen), filename, error->mse,
+                error->relMSE, error->ssim);
+}
+
 int main(int argc, char* argv[]) {
     --argc;
     ++argv;
@@ -106,7 +130,7 @@ int main(int argc, char* argv[]) {
             SWITCH(next()) {
                 CASE("--inplace" && argc)
                     ConvertFormat(files(), fmt, true);
-                CASE_BEGINWITH("--")
+                CASE_F(IsOption)
                     usage("convert [bmp | png] [--inplace] [filename]...");
                 DEFAULT
                     putback();
@@ -119,7 +143,7 @@ int main(int argc, char* argv[]) {
             SWITCH(next()){
                 CASE("--inplace") 
                     Scaling(files(), scale, true);
-                CASE_BEGINWITH("--")
+                CASE_F(IsOption)
                     usage("scaling [scale] [--inplace] [filename]...");
                 DEFAULT 
                     putback();
@@ -133,8 +157,16 @@ int main(int argc, char* argv[]) {
             if(files().size() != 2)  
                 usage("compress [from] [to]");
             Decompress(files()[0],files()[1]);         
+        CASE("merge")
+            if(files().size() < 2)
+                usage("merge [to] [shard]...");
+            Merge(files()[0], pstd::vector<pstd::string>(argv + 1, argv + argc));
+        CASE("compare")
+            if(files().size() < 2)
+                usage("compare [reference] [filename]...");
+            Compare(files()[0], pstd::vector<pstd::string>(argv + 1, argv + argc));
         DEFAULT
-            usage("Usage: imgtool [convert | scaling] [filename]...");
+            usage("Usage: imgtool [convert | scaling | merge | compare] [filename]...");
     }
 
     // clang-format on
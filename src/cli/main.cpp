@@ -1,12 +1,252 @@
 #include <core/integrator.h>
 #include <core/scene.h>
 #include <util/fileio.h>
+#include <util/parser.h>
 #include <util/profiler.h>
+#include <util/assetcache.h>
+#include <util/imagemetrics.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#define PINE_HAS_UNIX_SOCKET
+#endif
+
+using namespace pine;
+
+static bool ReadLine(FILE* stream, pstd::string& line) {
+    line = "";
+    char buffer[1024];
+    while (fgets(buffer, sizeof(buffer), stream)) {
+        line += buffer;
+        if (line.size() && line.back() == '\n')
+            break;
+    }
+    while (line.size() && pstd::isspace(line.back()))
+        line.pop_back();
+    return !feof(stream) || line.size() != 0;
+}
+
+// Jobs are blocks in the scene format terminated by a line containing `render`, the other
+// commands are `load filename` and `quit`; returns false once `quit` is received
+static bool ServeStream(FILE* in, FILE* out, pstd::shared_ptr<Scene>& scene,
+                        Parameters& sceneParams) {
+    pstd::string line, job;
+    while (ReadLine(in, line)) {
+        if (line == "quit") {
+            return false;
+        } else if (line.size() > 5 && pstd::trim(line, 0, 5) == "load ") {
+            scene = pstd::make_shared<Scene>();
+            sceneParams = LoadScene(pstd::trim(line, 5), scene.get());
+            fprintf(out, "loaded\n");
+        } else if (line == "render") {
+            Timer timer;
+            UpdateScene(sceneParams, Parse(job), scene.get());
+            scene->integrator->Render();
+            FlushImageWrites();
+            job = "";
+            LOG("[Server]Job finished in &.1s", timer.ElapsedMs() / 1000.0);
+            fprintf(out, "done\n");
+        } else {
+            job += line + "\n";
+        }
+        fflush(out);
+    }
+    return true;
+}
+
+static void Serve(pstd::string_view filename, pstd::string_view socketPath) {
+    FILE* out = stdout;
+#ifdef PINE_HAS_UNIX_SOCKET
+    if (socketPath == "") {
+        // Replies keep the original stdout and logs are moved to stderr, so clients parsing
+        // `loaded` and `done` never see log lines
+        fflush(stdout);
+        out = fdopen(dup(STDOUT_FILENO), "w");
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+    }
+#endif
+
+    auto scene = pstd::make_shared<Scene>();
+    Parameters sceneParams = LoadScene(filename, scene.get());
+
+    if (socketPath == "") {
+        LOG("[Server]Reading jobs from stdin");
+        ServeStream(stdin, out, scene, sceneParams);
+        if (out != stdout)
+            fclose(out);
+        return;
+    }
+
+#ifdef PINE_HAS_UNIX_SOCKET
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    pstd::memcpy(addr.sun_path, socketPath.data(),
+                 pstd::min(socketPath.size(), sizeof(addr.sun_path) - 1));
+    unlink(addr.sun_path);
+    if (fd < 0 || bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 4) != 0) {
+        LOG_WARNING("[Server]Cannot listen on \"&\"", socketPath);
+        return;
+    }
+    LOG("[Server]Listening on \"&\"", socketPath);
+
+    for (bool running = true; running;) {
+        int connection = accept(fd, nullptr, nullptr);
+        if (connection < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            LOG_WARNING("[Server]Cannot accept connections: &", strerror(errno));
+            break;
+        }
+        FILE* in = fdopen(connection, "r");
+        FILE* out = fdopen(dup(connection), "w");
+        running = ServeStream(in, out, scene, sceneParams);
+        fclose(in);
+        fclose(out);
+    }
+    close(fd);
+    unlink(addr.sun_path);
+#else
+    LOG_WARNING("[Server]Unix sockets are unavailable on this platform, use stdin instead");
+#endif
+}
+
+// Renders every scene listed in `filename`, one per line; meshes, volumes, textures and the
+// BVHs of identical meshes are shared by consecutive scenes through the AssetCache
+static void Batch(pstd::string_view filename) {
+    Timer timer;
+    AssetCache::enabled = true;
+    int nScenes = 0;
+
+    pstd::string jobs = ReadStringFile(filename);
+    for (size_t i = 0; i < jobs.size();) {
+        size_t end = pstd::find(jobs.begin() + i, jobs.end(), '\n') - jobs.begin();
+        pstd::string line = pstd::trim(jobs, i, end - i);
+        i = end + 1;
+        while (line.size() && pstd::isspace(line.back()))
+            line.pop_back();
+        if (line.size() == 0 || line[0] == '#')
+            continue;
+
+        auto scene = pstd::make_shared<Scene>();
+        LoadScene(line, scene.get());
+        scene->integrator->Render();
+        FlushImageWrites();
+        AssetCache::EndScene();
+        nScenes++;
+    }
+
+    LOG("[Batch]& scenes rendered in &.1s, & assets reused, & released", nScenes,
+        timer.ElapsedMs() / 1000.0, AssetCache::hits, AssetCache::evictions);
+}
+
+// Renders the scene with every Integrator block of `harnessFile` at each budget of the
+// `Efficiency` block and writes error-versus-time curves against a reference image:
+//   Efficiency{ reference: ref.bmp referenceSpp: 1024 budgets: 1 4 16 64 output: curves.csv }
+// A budget is samples per pixel, mutations per pixel for MLT and iterations for SPPM.
+// Errors are measured on the film's float output rather than the quantized files; the reference
+// is rendered with the scene's own integrator and kept as floats next to its image ("ref.bin")
+static void Efficiency(pstd::string_view sceneFile, pstd::string_view harnessFile) {
+    Parameters harness = Parse(ReadStringFile(harnessFile));
+    const Parameters& options = harness["Efficiency"];
+    pstd::string reference =
+        ChangeFileExtension(options.GetString("reference", "reference"), "bmp");
+    pstd::string output = options.GetString("output", "efficiency.csv");
+    pstd::string budgetList = options.GetString("budgets", "1 4 16 64");
+    pstd::vector<int> budgets(pstd::count(budgetList.begin(), budgetList.end(), ' ') + 1);
+    pstd::stois(budgetList, &budgets[0], budgets.size());
+
+    auto scene = pstd::make_shared<Scene>();
+    Parameters sceneParams = LoadScene(sceneFile, scene.get());
+    // Images are only written as BMP, and the whole frame must stay in memory to be compared
+    pstd::string outputFileName = ChangeFileExtension(
+        sceneParams["Camera"]["film"].GetString("outputFileName", "result"), "bmp");
+    sceneParams["Camera"]["film"].Set("tileSize", 0);
+
+    auto render = [&](Parameters integrator, int spp, pstd::string filename) {
+        integrator["sampler"].Set("samplesPerPixel", spp);
+        integrator["sampler"].Set("xPixelSamples", int(pstd::ceil(pstd::sqrt(float(spp)))));
+        integrator["sampler"].Set("yPixelSamples", int(pstd::ceil(pstd::sqrt(float(spp)))));
+        // MLT and SPPM size their work by these rather than by the sampler
+        integrator.Set("mutationsPerPixel", spp);
+        integrator.Set("nIterations", spp);
+        sceneParams["Camera"]["film"].Set("outputFileName", filename);
+        Parameters job;
+        job.AddSubset("Camera") = sceneParams["Camera"];
+        job.AddSubset("Integrator") = integrator;
+        UpdateScene(sceneParams, job, scene.get());
+        Timer timer;
+        scene->integrator->Render();
+        double seconds = timer.ElapsedMs() / 1000.0;
+        FlushImageWrites();
+        pstd::vector<vec3> image = scene->integrator->film->FinalizedImage();
+        return pstd::pair<double, pstd::vector<vec3>>{seconds, pstd::move(image)};
+    };
+
+    pstd::string referenceData =
+        GetFileDirectory(sceneFile) + ChangeFileExtension(reference, "bin");
+    pstd::vector<vec3> referenceImage;
+    if (IsFileExist(referenceData)) {
+        referenceImage = Deserialize<pstd::vector<vec3>>(referenceData);
+    } else {
+        LOG("[Efficiency]Rendering reference \"&\"", reference);
+        referenceImage =
+            render(sceneParams["Integrator"], options.GetInt("referenceSpp", 1024), reference)
+                .second;
+        Serialize(referenceData, referenceImage);
+    }
+    vec2i size = scene->integrator->film->Size();
+    if ((int)referenceImage.size() != Area(size))
+        LOG_FATAL("[Efficiency]Reference \"&\" does not match the film size &, delete it to render "
+                  "it again",
+                  referenceData, size);
+
+    pstd::string csv = "config,integrator,spp,seconds,mse,relmse,ssim,efficiency\n";
+    const pstd::vector<Parameters>& configs = harness.GetAll("Integrator");
+    for (size_t i = 0; i < configs.size(); i++) {
+        pstd::string type = configs[i].GetString("type");
+        for (int spp : budgets) {
+            pstd::string filename =
+                AppendFileName(outputFileName, pstd::to_string("_", i, type, "_", spp, "spp"));
+            auto [seconds, image] = render(configs[i], spp, filename);
+            if (image.size() != referenceImage.size())
+                LOG_FATAL("[Efficiency]\"&\" does not match the reference size", filename);
+            ImageError error = CompareImages(image.data(), referenceImage.data(), size);
+            // Inverse of the work-normalized error, higher is better
+            double efficiency = 1.0 / pstd::max(error.mse * seconds, 1e-12);
+            LOG("[Efficiency]& &  &spp  &.2s  MSE &.6  relMSE &.6  SSIM &.4  efficiency &.1",
+                i, type, spp, seconds, error.mse, error.relMSE, error.ssim, efficiency);
+            csv += pstd::to_string(i, ",", type, ",", spp, ",", seconds, ",", error.mse, ",",
+                                   error.relMSE, ",", error.ssim, ",", efficiency, "\n");
+        }
+    }
+
+    WriteBinaryData(output, csv.data(), csv.size());
+    LOG("[Efficiency]Curves written to \"&\"", output);
+}
 
 int main(int argc, char* argv[]) {
-    using namespace pine;
-    if (argc != 2) {
-        LOG("Usage: pine [filename]");
+    bool resume = argc == 3 && pstd::string(argv[1]) == "--resume";
+    bool efficiency = argc == 4 && pstd::string(argv[1]) == "--efficiency";
+    bool batch = argc == 3 && pstd::string(argv[1]) == "--batch";
+    bool serve = (argc == 3 || argc == 4) && pstd::string(argv[1]) == "--serve";
+    int shardIndex = 0, shardCount = 1;
+    bool shard = argc == 4 && pstd::string(argv[1]) == "--shard" &&
+                 sscanf(argv[2], "%d/%d", &shardIndex, &shardCount) == 2 && shardIndex >= 0 &&
+                 shardIndex < shardCount;
+    if (argc != 2 && !resume && !batch && !serve && !shard && !efficiency) {
+        LOG("Usage: pine [--resume] [filename]");
+        LOG("       pine --shard [index/count] [filename]");
+        LOG("       pine --batch [joblist]");
+        LOG("       pine --efficiency [filename] [harness]");
+        LOG("       pine --serve [filename] [socket]");
         return 0;
     }
 
@@ -15,15 +255,43 @@ int main(int argc, char* argv[]) {
 #endif
 
     Profiler::Initialize();
-    SampledProfiler::Initialize();
+    // PINE_PROFILE_RATE sets the sampling frequency of the SampledProfiler in Hz, 0 disables it
+    const char* profileRate = getenv("PINE_PROFILE_RATE");
+    SampledProfiler::Initialize(profileRate ? atoi(profileRate) : 100);
+    // PINE_PERF_COUNTERS=1 reports the hardware counters of each profiled phase
+    if (const char* perfCounters = getenv("PINE_PERF_COUNTERS"); perfCounters && atoi(perfCounters))
+        PhaseCounters::Initialize();
+    // PINE_TRACE names a Chrome trace-event file written at exit
+    if (const char* trace = getenv("PINE_TRACE"))
+        Trace::Enable(trace);
+    // PINE_PROGRESS names a file or "fd:N" receiving one JSON line of progress and throughput
+    // every PINE_PROGRESS_INTERVAL seconds
+    if (const char* progress = getenv("PINE_PROGRESS")) {
+        const char* interval = getenv("PINE_PROGRESS_INTERVAL");
+        Telemetry::StartFeed(progress, interval ? atof(interval) : 1.0f);
+    }
     SampledSpectrum::Initialize();
 
-    auto scene = pstd::make_shared<Scene>();
-    LoadScene(argv[1], scene.get());
-    scene->integrator->Render();
+    if (serve) {
+        Serve(argv[2], argc == 4 ? argv[3] : "");
+    } else if (batch) {
+        Batch(argv[2]);
+    } else if (efficiency) {
+        Efficiency(argv[2], argv[3]);
+    } else {
+        auto scene = pstd::make_shared<Scene>();
+        LoadScene(argv[argc - 1], scene.get());
+        scene->integrator->checkpointer.resume = resume;
+        scene->integrator->shardIndex = shardIndex;
+        scene->integrator->shardCount = shardCount;
+        scene->integrator->Render();
+        FlushImageWrites();
+    }
 
     SampledProfiler::Finalize();
+    PhaseCounters::Finalize();
+    Telemetry::Finalize();
     Profiler::Finalize();
 
     return 0;
-}
\ No newline at end of file
+}
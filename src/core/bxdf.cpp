@@ -76,6 +76,9 @@ float ConductorBSDF::PDF(vec3 wi, vec3 wo, const NodeEvalCtx& nc) const {
 
     return distrib.PDF(wi, wh) / (4 * AbsDot(wi, wh));
 }
+bool ConductorBSDF::IsSpecular(const NodeEvalCtx& nc) const {
+    return pstd::clamp(pstd::sqr(roughness.EvalFloat(nc)), 0.001f, 1.0f) < 0.2f;
+}
 
 pstd::optional<BSDFSample> DielectricBSDF::Sample(vec3 wi, float u1, vec2 u2,
                                                   const NodeEvalCtx& nc) const {
@@ -163,6 +166,9 @@ float DielectricBSDF::PDF(vec3 wi, vec3 wo, const NodeEvalCtx& nc) const {
         return (1.0f - fr) * distrib.PDF(wi, wm) * dwm_dwo;
     }
 }
+bool DielectricBSDF::IsSpecular(const NodeEvalCtx& nc) const {
+    return pstd::clamp(pstd::sqr(roughness.EvalFloat(nc)), 0.001f, 1.0f) < 0.2f;
+}
 
 DiffuseBSDF DiffuseBSDF::Create(const Parameters& params) {
     return DiffuseBSDF(CreateNode(params["albedo"]));
@@ -24,6 +24,12 @@ struct DiffuseBSDF {
     pstd::optional<BSDFSample> Sample(vec3 wi, float u1, vec2 u, const NodeEvalCtx& nc) const;
     vec3 F(vec3 wi, vec3 wo, const NodeEvalCtx& nc) const;
     float PDF(vec3 wi, vec3 wo, const NodeEvalCtx& nc) const;
+    vec3 Albedo(const NodeEvalCtx& nc) const {
+        return albedo.EvalVec3(nc);
+    }
+    bool IsSpecular(const NodeEvalCtx&) const {
+        return false;
+    }
 
     NodeInput albedo;
 };
@@ -35,6 +41,11 @@ struct ConductorBSDF {
     pstd::optional<BSDFSample> Sample(vec3 wi, float u1, vec2 u2, const NodeEvalCtx& nc) const;
     vec3 F(vec3 wi, vec3 wo, const NodeEvalCtx& nc) const;
     float PDF(vec3 wi, vec3 wo, const NodeEvalCtx& nc) const;
+    vec3 Albedo(const NodeEvalCtx& nc) const {
+        return albedo.EvalVec3(nc);
+    }
+    // Whether Sample() marks its directions as specular
+    bool IsSpecular(const NodeEvalCtx& nc) const;
 
     NodeInput albedo;
     NodeInput roughness;
@@ -48,6 +59,11 @@ struct DielectricBSDF {
     pstd::optional<BSDFSample> Sample(vec3 wi, float u1, vec2 u2, const NodeEvalCtx& nc) const;
     vec3 F(vec3 wi, vec3 wo, const NodeEvalCtx& nc) const;
     float PDF(vec3 wi, vec3 wo, const NodeEvalCtx& nc) const;
+    vec3 Albedo(const NodeEvalCtx& nc) const {
+        return albedo.EvalVec3(nc);
+    }
+    // Whether Sample() marks its directions as specular
+    bool IsSpecular(const NodeEvalCtx& nc) const;
 
     NodeInput albedo;
     NodeInput roughness;
@@ -67,6 +83,12 @@ class BSDF : public TaggedVariant<DiffuseBSDF, ConductorBSDF, DielectricBSDF> {
     float PDF(vec3 wi, vec3 wo, const NodeEvalCtx& nc) const {
         return Dispatch([&](auto&& x) { return x.PDF(wi, wo, nc); });
     }
+    vec3 Albedo(const NodeEvalCtx& nc) const {
+        return Dispatch([&](auto&& x) { return x.Albedo(nc); });
+    }
+    bool IsSpecular(const NodeEvalCtx& nc) const {
+        return Dispatch([&](auto&& x) { return x.IsSpecular(nc); });
+    }
 };
 
 BSDF CreateBSDF(const Parameters& params);
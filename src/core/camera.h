@@ -57,6 +57,7 @@ struct Camera : public TaggedVariant<ThinLenCamera> {
 
     Ray GenRay(vec2 pFilm, vec2 u2) const {
         SampledProfiler _(ProfilePhase::GenerateRay);
+        Telemetry::Count(TelemetryCounter::CameraRays);
         Ray ray = Dispatch([&](auto&& x) { return x.GenRay(pFilm, u2); });
         ray.medium = medium.get();
         return ray;
@@ -91,9 +91,7 @@ Spectrum AtmosphereColor(vec3 direction, vec3 sunDirection, vec3 sunColor) {
 Spectrum SkyColor(vec3 direction, vec3 sunDirection, vec3 sunColor) {
     if (sunDirection == direction)
         return vec3(8.0f * sunColor);
-    pstd::swap(direction.y, direction.z);
-    auto [phi, theta] = CartesianToSpherical(direction);
-    theta /= Pi;
+    float theta = pstd::acos(direction.y) / Pi;
     return sunColor *
            pstd::sqr(pstd::lerp(theta, vec3(0.01f, 0.03f, 0.3f), vec3(0.3f, 0.5f, 0.8f)));
 }
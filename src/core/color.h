@@ -15,6 +15,13 @@ inline float Luminance(vec3 color) {
 }
 
 vec3 Uncharted2Flimic(vec3 v);
+inline float Uncharted2Flimic(float v) {
+    auto mapping = [](float x) {
+        return (x * (0.15f * x + 0.05f) + 0.004f) / (x * (0.15f * x + 0.50f) + 0.06f) -
+               0.02f / 0.30f;
+    };
+    return mapping(v * 2.0f) / mapping(11.2f);
+}
 
 vec3 ACES(vec3 v);
 
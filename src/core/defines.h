@@ -61,6 +61,7 @@ struct Material;
 struct Camera;
 struct Medium;
 struct Scene;
+struct DTree;
 struct Shape;
 struct AABB;
 struct Ray;
@@ -6,19 +6,72 @@
 namespace pine {
 
 Film CreateFilm(const Parameters& params) {
-    return Film(params.GetVec2i("size", vec2i(720, 480)), CreateFilter(params["filter"]),
-                params.GetString("outputFileName", "result.png"),
-                params.GetBool("applyToneMapping", true),
-                params.GetBool("reportAverageColor", false));
+    FilmOptions options;
+    options.outputFileName = params.GetString("outputFileName", options.outputFileName);
+    options.applyToneMapping = params.GetBool("applyToneMapping", options.applyToneMapping);
+    options.reportAverageColor = params.GetBool("reportAverageColor", options.reportAverageColor);
+    options.importanceSampleFilter =
+        params.GetBool("importanceSampleFilter", options.importanceSampleFilter);
+    options.writeAOVs = params.GetBool("writeAOVs", options.writeAOVs);
+    options.writeCost = params.GetBool("writeCost", options.writeCost);
+    options.denoiseIterations = params.GetInt("denoiseIterations", options.denoiseIterations);
+    options.tileSize = params.GetInt("tileSize", options.tileSize);
+    options.cropWindow = params.GetVec4("cropWindow", options.cropWindow);
+    options.cropBackground = params.GetString("cropBackground", options.cropBackground);
+    return Film(params.GetVec2i("size", vec2i(720, 480)), CreateFilter(params["filter"]), options);
 }
 
-Film::Film(vec2i size, Filter filter, pstd::string outputFileName, bool applyToneMapping,
-           bool reportAverageColor)
+void MergeFilmShards(const pstd::vector<FilmShard>& shards, pstd::string outputFileName) {
+    if (shards.size() == 0)
+        return;
+    auto background = [](const FilmShard& shard) {
+        return pstd::string(shard.cropBackground.data(), shard.cropBackground.size());
+    };
+    const FilmShard& first = shards[0];
+    vec2i size = first.size;
+    pstd::vector<float> accumulation(first.accumulation.size());
+    int nSamples = 0;
+    for (const FilmShard& shard : shards) {
+        if (shard.size != size || shard.accumulation.size() != accumulation.size()) {
+            LOG_WARNING("[Film][MergeFilmShards]Shard has size &, expect &", shard.size, size);
+            return;
+        }
+        if (shard.cropWindow != first.cropWindow || background(shard) != background(first)) {
+            LOG_WARNING("[Film][MergeFilmShards]Shard has crop window &, expect &",
+                        shard.cropWindow, first.cropWindow);
+            return;
+        }
+        for (size_t i = 0; i < accumulation.size(); i++)
+            accumulation[i] += shard.accumulation[i];
+        nSamples += shard.nSamples;
+    }
+
+    FilmOptions options;
+    options.outputFileName = outputFileName;
+    options.applyToneMapping = first.applyToneMapping;
+    options.cropWindow = first.cropWindow;
+    options.cropBackground = background(first);
+    Film film(size, CreateFilter({}), options);
+    film.LoadAccumulation(accumulation);
+    film.Finalize(1.0f / nSamples);
+}
+
+Film::Film(vec2i size, Filter filter, const FilmOptions& options)
     : size(size),
+      bufferSize(size),
       filter(filter),
-      outputFileName(outputFileName),
-      applyToneMapping(applyToneMapping),
-      reportAverageColor(reportAverageColor) {
+      outputFileName(options.outputFileName),
+      applyToneMapping(options.applyToneMapping),
+      reportAverageColor(options.reportAverageColor),
+      importanceSampleFilter(options.importanceSampleFilter),
+      writeAOVs(options.writeAOVs),
+      writeCost(options.writeCost),
+      denoiseIterations(options.denoiseIterations),
+      tileSize(pstd::max(options.tileSize, 0)),
+      cropWindow(options.cropWindow),
+      cropBackground(options.cropBackground),
+      cropMin(Max(vec2i(Floor(vec2(options.cropWindow.x, options.cropWindow.y) * size)), vec2i(0))),
+      cropMax(Min(vec2i(Ceil(vec2(options.cropWindow.z, options.cropWindow.w) * size)), size)) {
     int offset = 0;
     for (int y = 0; y < filterTableWidth; y++)
         for (int x = 0; x < filterTableWidth; x++) {
@@ -26,12 +79,75 @@ Film::Film(vec2i size, Filter filter, pstd::string outputFileName, bool applyTon
                       (y + 0.5f) / filterTableWidth * filter.Radius().y};
             filterTable[offset++] = filter.Evaluate(p);
         }
-    pixels = pstd::shared_ptr<Pixel[]>(new Pixel[Area(size)]);
-    rgba = pstd::shared_ptr<vec4[]>(new vec4[Area(size)]);
+    if (importanceSampleFilter) {
+        float absFilterTable[filterTableWidth * filterTableWidth];
+        for (int i = 0; i < filterTableWidth * filterTableWidth; i++)
+            absFilterTable[i] = pstd::abs(filterTable[i]);
+        filterDistribution = Distribution2D(absFilterTable, filterTableWidth, filterTableWidth);
+    }
+    if (IsCropped() && options.cropBackground != "") {
+        vec2i backgroundSize;
+        background =
+            pstd::shared_ptr<vec3u8[]>(ReadLDRImage(options.cropBackground, backgroundSize));
+        if (background && backgroundSize != size) {
+            LOG_WARNING("[Film]Crop background & has size &, expect &", options.cropBackground,
+                        backgroundSize, size);
+            background = nullptr;
+        }
+    }
+    if (IsTiled()) {
+        bufferSize = Min(vec2i(tileSize), size);
+        if (writeAOVs || writeCost || denoiseIterations > 0)
+            LOG_WARNING("[Film]AOVs, cost and denoising are not supported by the tiled film");
+    }
+    Allocate();
+}
+void Film::Allocate() {
+    pixels = pstd::shared_ptr<Pixel[]>(new Pixel[Area(bufferSize)]);
+    rgba = pstd::shared_ptr<vec4[]>(new vec4[Area(bufferSize)]);
+    if (!IsTiled() && (writeAOVs || denoiseIterations > 0))
+        aovPixels = pstd::shared_ptr<AOVPixel[]>(new AOVPixel[Area(size)]);
+    if (!IsTiled() && writeCost)
+        pixelCosts = pstd::shared_ptr<uint64_t[]>(new uint64_t[Area(size)]());
+}
+
+pstd::pair<vec2i, vec2i> Film::SampleBounds() const {
+    if (!IsCropped())
+        return {vec2i(0), size};
+    return {Max(cropMin - FilterApron(), vec2i(0)), Min(cropMax + FilterApron(), size)};
+}
+pstd::pair<vec2i, vec2i> Film::BeginTile(vec2i tile) {
+    bufferOrigin = tile * tileSize;
+    bufferSize = Min(bufferOrigin + vec2i(tileSize), size) - bufferOrigin;
+    Clear();
+
+    auto [sampleMin, sampleMax] = SampleBounds();
+    vec2i lower = Max(bufferOrigin - FilterApron(), sampleMin);
+    vec2i upper = Min(bufferOrigin + bufferSize + FilterApron(), sampleMax);
+    return {lower, Max(upper, lower)};
+}
+void Film::EndTile(TiledImageWriter& writer, float splatMultiplier) {
+    tileColorSum += ResolveAndMap(splatMultiplier);
+    writer.WriteTile(bufferOrigin, bufferSize, (const float*)&rgba[0]);
+
+    if (bufferOrigin + bufferSize == size) {
+        if (reportAverageColor)
+            LOG("[Film]Average RGB color: &", vec4(tileColorSum / Area(size), 1.0f));
+        tileColorSum = {};
+    }
+}
+void Film::DisableTiling() {
+    if (!IsTiled())
+        return;
+    LOG_WARNING("[Film]Tiled film is unsupported by this render mode, using a full-frame film");
+    tileSize = 0;
+    bufferOrigin = {};
+    bufferSize = size;
+    Allocate();
 }
 
 void Film::Clear() {
-    for (int i = 0; i < Area(size); i++) {
+    for (int i = 0; i < Area(bufferSize); i++) {
         pixels[i].rgb[0] = 0.0f;
         pixels[i].rgb[1] = 0.0f;
         pixels[i].rgb[2] = 0.0f;
@@ -41,62 +157,326 @@ void Film::Clear() {
         pixels[i].weight = 0.0f;
         rgba[i] = {};
     }
+    if (HasAOVs())
+        for (int i = 0; i < Area(size); i++) {
+            for (int c = 0; c < 3; c++) {
+                aovPixels[i].albedo[c] = 0.0f;
+                aovPixels[i].n[c] = 0.0f;
+            }
+            aovPixels[i].depth = 0.0f;
+            aovPixels[i].weight = 0.0f;
+        }
+    if (RecordsCost())
+        pstd::fill(pixelCosts.get(), pixelCosts.get() + Area(size), uint64_t(0));
 }
-void Film::Finalize(float splatMultiplier) {
-    CopyToRGBArray(splatMultiplier);
-
-    if (reportAverageColor) {
-        vec4 avg;
-        for (int i = 0; i < Area(size); i++)
-            avg += rgba[i];
-        avg /= Area(size);
-        LOG("[Film]Average RGB color: &", avg);
+pstd::vector<float> Film::SaveAccumulation() const {
+    pstd::vector<float> data(Area(size) * 7);
+    for (int i = 0; i < Area(size); i++) {
+        const Pixel& pixel = pixels[i];
+        float* p = &data[i * 7];
+        for (int c = 0; c < 3; c++) {
+            p[c] = pixel.rgb[c];
+            p[3 + c] = pixel.splatXYZ[c];
+        }
+        p[6] = pixel.weight;
+    }
+    return data;
+}
+bool Film::LoadAccumulation(const pstd::vector<float>& data) {
+    if ((int)data.size() != Area(size) * 7) {
+        LOG_WARNING("[Film][LoadAccumulation]Size mismatch, expect & values, get &",
+                    Area(size) * 7, data.size());
+        return false;
     }
+    for (int i = 0; i < Area(size); i++) {
+        Pixel& pixel = pixels[i];
+        const float* p = &data[i * 7];
+        for (int c = 0; c < 3; c++) {
+            pixel.rgb[c] = p[c];
+            pixel.splatXYZ[c] = p[3 + c];
+        }
+        pixel.weight = p[6];
+    }
+    return true;
+}
+void Film::Finalize(float splatMultiplier, bool newFrame) {
+    int nPixels = Area(size);
+    vec3 sum;
 
-    if (applyToneMapping)
-        ApplyToneMapping();
+    if (denoiseIterations > 0 && HasAOVs()) {
+        int nBlocks = (nPixels + finalizeBlockSize - 1) / finalizeBlockSize;
+        pstd::vector<vec3> sums(NumThreads());
+        ParallelFor(nBlocks, [&](int block) {
+            float r[finalizeBlockSize], g[finalizeBlockSize], b[finalizeBlockSize];
+            int first = block * finalizeBlockSize;
+            int count = pstd::min(finalizeBlockSize, nPixels - first);
+            ResolveBlock(first, count, splatMultiplier, r, g, b, sums[threadIdx]);
+            for (int i = 0; i < count; i++)
+                rgba[first + i] = vec4(r[i], g[i], b[i], 1.0f);
+        });
+        Denoise();
+        ParallelFor(nBlocks, [&](int block) {
+            float r[finalizeBlockSize], g[finalizeBlockSize], b[finalizeBlockSize];
+            int first = block * finalizeBlockSize;
+            int count = pstd::min(finalizeBlockSize, nPixels - first);
+            for (int i = 0; i < count; i++) {
+                r[i] = rgba[first + i].x;
+                g[i] = rgba[first + i].y;
+                b[i] = rgba[first + i].z;
+            }
+            MapBlock(first, count, r, g, b);
+        });
+        for (vec3 s : sums)
+            sum += s;
+    } else {
+        sum = ResolveAndMap(splatMultiplier);
+    }
 
-    ApplyGammaCorrection();
+    if (reportAverageColor)
+        LOG("[Film]Average RGB color: &", vec4(sum / nPixels, 1.0f));
 
-    if (frameId == 0)
-        WriteToDisk(outputFileName);
-    else
-        WriteToDisk(AppendFileName(outputFileName, pstd::to_string("_frame_", frameId)));
-    frameId++;
+    pstd::string filename = outputFileName;
+    if (frameId != 0)
+        filename = AppendFileName(outputFileName, pstd::to_string("_frame_", frameId));
+    WriteToDisk(filename);
+    if (writeAOVs && HasAOVs())
+        WriteAOVsToDisk(filename);
+    if (RecordsCost())
+        WriteCostToDisk(filename);
+    if (newFrame)
+        frameId++;
 }
 void Film::WriteToDisk(pstd::string_view filename) const {
-    pstd::unique_ptr<vec4u8[]> rgba8 = pstd::unique_ptr<vec4u8[]>(new vec4u8[Area(size)]);
+    const float* data = (const float*)&rgba[0];
+    SaveImageAsync(filename, size, 4, pstd::vector<float>(data, data + Area(size) * 4));
+}
+pstd::vector<vec3> Film::FinalizedImage() const {
+    if (IsTiled())
+        return {};
+    pstd::vector<vec3> image(Area(size));
     for (int i = 0; i < Area(size); i++)
-        rgba8[i] = rgba[i] * 255;
-    SaveImage(filename, size, 4, (float*)&rgba[0]);
+        image[i] = vec3(rgba[i]);
+    return image;
 }
+void Film::WriteAOVsToDisk(pstd::string_view filename) const {
+    int nPixels = Area(size);
+    pstd::vector<float> albedo(nPixels * 4), normal(nPixels * 4), depth(nPixels * 4);
+    // Normalize by twice the mean depth so unbounded geometry doesn't wash out the image
+    float depthScale = 0.0f;
+    int nValid = 0;
+    for (int i = 0; i < nPixels; i++)
+        if (aovPixels[i].weight != 0.0f) {
+            depthScale += aovPixels[i].depth / aovPixels[i].weight;
+            nValid++;
+        }
+    depthScale = depthScale != 0.0f ? nValid / (2 * depthScale) : 0.0f;
 
-void Film::CopyToRGBArray(float splatMultiplier) {
-    for (int i = 0; i < Area(size); i++) {
-        auto& pixel = pixels[i];
-        if (pixel.weight != 0.0f)
-            for (int c = 0; c < 3; c++)
-                rgba[i][c] = float(pixel.rgb[c]) / (float)pixel.weight;
-        else
-            rgba[i] = {};
+    ParallelFor(nPixels, [&](int i) {
+        const AOVPixel& aov = aovPixels[i];
+        float invWeight = aov.weight != 0.0f ? 1.0f / aov.weight : 0.0f;
+        vec3 n = vec3(float(aov.n[0]), float(aov.n[1]), float(aov.n[2]));
+        n = Normalize(n + vec3(1e-8f));
+        for (int c = 0; c < 3; c++) {
+            albedo[i * 4 + c] = FastPow(aov.albedo[c] * invWeight, 1.0f / 2.2f);
+            normal[i * 4 + c] = aov.weight != 0.0f ? n[c] * 0.5f + 0.5f : 0.0f;
+            depth[i * 4 + c] = aov.depth * invWeight * depthScale;
+        }
+        albedo[i * 4 + 3] = normal[i * 4 + 3] = depth[i * 4 + 3] = 1.0f;
+    });
+
+    SaveImageAsync(AppendFileName(filename, "_albedo"), size, 4, pstd::move(albedo));
+    SaveImageAsync(AppendFileName(filename, "_normal"), size, 4, pstd::move(normal));
+    SaveImageAsync(AppendFileName(filename, "_depth"), size, 4, pstd::move(depth));
+}
+
+void Film::WriteCostToDisk(pstd::string_view filename) const {
+    int nPixels = Area(size);
+    uint64_t maxCost = 0;
+    double meanCost = 0.0;
+    for (int i = 0; i < nPixels; i++) {
+        maxCost = pstd::max(maxCost, pixelCosts[i]);
+        meanCost += pixelCosts[i];
+    }
+    meanCost /= nPixels;
+    LOG("[Film]Pixel cost: mean &.0 cycles, max & cycles", meanCost, maxCost);
 
+    // Four times the mean maps to red so a few outliers don't compress the rest of the image
+    float scale = meanCost != 0.0 ? 1.0f / (4.0 * meanCost) : 0.0f;
+    pstd::vector<float> cost(nPixels * 4);
+    ParallelFor(nPixels, [&](int i) {
+        vec3 color = ColorMap(pixelCosts[i] * scale);
+        for (int c = 0; c < 3; c++)
+            cost[i * 4 + c] = color[c];
+        cost[i * 4 + 3] = 1.0f;
+    });
+    SaveImageAsync(AppendFileName(filename, "_cost"), size, 4, pstd::move(cost));
+}
+
+vec3 Film::ResolveAndMap(float splatMultiplier) {
+    int nPixels = Area(bufferSize);
+    int nBlocks = (nPixels + finalizeBlockSize - 1) / finalizeBlockSize;
+    pstd::vector<vec3> sums(NumThreads());
+    ParallelFor(nBlocks, [&](int block) {
+        float r[finalizeBlockSize], g[finalizeBlockSize], b[finalizeBlockSize];
+        int first = block * finalizeBlockSize;
+        int count = pstd::min(finalizeBlockSize, nPixels - first);
+        ResolveBlock(first, count, splatMultiplier, r, g, b, sums[threadIdx]);
+        MapBlock(first, count, r, g, b);
+    });
+
+    vec3 sum;
+    for (vec3 s : sums)
+        sum += s;
+    return sum;
+}
+void Film::ResolveBlock(int first, int count, float splatMultiplier, float* r, float* g,
+                        float* b, vec3& sum) {
+    for (int i = 0; i < count; i++) {
+        const Pixel& pixel = pixels[first + i];
+        float weight = pixel.weight;
+        float invWeight = weight != 0.0f ? 1.0f / weight : 0.0f;
         float splatXYZ[3] = {pixel.splatXYZ[0], pixel.splatXYZ[1], pixel.splatXYZ[2]};
         float splatRGB[3];
         XYZToRGB(splatXYZ, splatRGB);
-        rgba[i][0] += splatRGB[0] * splatMultiplier;
-        rgba[i][1] += splatRGB[1] * splatMultiplier;
-        rgba[i][2] += splatRGB[2] * splatMultiplier;
-
-        rgba[i][3] = 1.0f;
+        r[i] = pixel.rgb[0] * invWeight + splatRGB[0] * splatMultiplier;
+        g[i] = pixel.rgb[1] * invWeight + splatRGB[1] * splatMultiplier;
+        b[i] = pixel.rgb[2] * invWeight + splatRGB[2] * splatMultiplier;
     }
+
+    if (reportAverageColor)
+        for (int i = 0; i < count; i++)
+            sum += vec3(r[i], g[i], b[i]);
 }
-void Film::ApplyToneMapping() {
-    for (int i = 0; i < Area(size); i++)
-        rgba[i] = vec4(Uncharted2Flimic(rgba[i]), rgba[i].w);
+void Film::MapBlock(int first, int count, float* r, float* g, float* b) {
+    if (applyToneMapping)
+        for (int i = 0; i < count; i++) {
+            r[i] = Uncharted2Flimic(r[i]);
+            g[i] = Uncharted2Flimic(g[i]);
+            b[i] = Uncharted2Flimic(b[i]);
+        }
+
+    for (int i = 0; i < count; i++) {
+        r[i] = FastPow(r[i], 1.0f / 2.2f);
+        g[i] = FastPow(g[i], 1.0f / 2.2f);
+        b[i] = FastPow(b[i], 1.0f / 2.2f);
+    }
+
+    for (int i = 0; i < count; i++)
+        rgba[first + i] = vec4(r[i], g[i], b[i], 1.0f);
+
+    if (IsCropped())
+        for (int i = first; i < first + count; i++) {
+            vec2i p = bufferOrigin + vec2i(i % bufferSize.x, bufferSize.y - 1 - i / bufferSize.x);
+            if (Inside(p, cropMin, cropMax))
+                continue;
+            vec3 color;
+            if (background)
+                color = (vec3(background[(size.y - 1 - p.y) * size.x + p.x]) + vec3(0.5f)) / 256;
+            rgba[i] = vec4(color, 1.0f);
+        }
 }
-void Film::ApplyGammaCorrection() {
-    for (int i = 0; i < Area(size); i++)
-        rgba[i] = vec4(Pow((vec3)rgba[i], 1.0f / 2.2f), rgba[i].w);
+
+// Edge-avoiding A-Trous wavelet filter [Dammertz et al. 2010] on albedo-demodulated color; the
+// guides are kept in per-channel planes and each tap is applied to a span of a row at once, so
+// the weight computation auto-vectorizes
+void Film::Denoise() {
+    Profiler _("Denoise");
+    const float sigmaColor = 4.0f, sigmaAlbedo = 0.1f, sigmaDepth = 0.1f, normalExponent = 64.0f;
+    const float kernel[3] = {3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f};
+
+    int nPixels = Area(size);
+    pstd::vector<float> color[3], next[3], albedo[3], normal[3];
+    for (int c = 0; c < 3; c++) {
+        color[c].resize(nPixels);
+        next[c].resize(nPixels);
+        albedo[c].resize(nPixels);
+        normal[c].resize(nPixels);
+    }
+    pstd::vector<float> depth(nPixels), hasNormal(nPixels), luminance(nPixels);
+
+    ParallelFor(nPixels, [&](int i) {
+        const AOVPixel& aov = aovPixels[i];
+        vec3 a(1.0f), n;
+        if (aov.weight != 0.0f) {
+            float invWeight = 1.0f / aov.weight;
+            a = vec3(float(aov.albedo[0]), float(aov.albedo[1]), float(aov.albedo[2])) * invWeight;
+            n = Normalize(vec3(float(aov.n[0]), float(aov.n[1]), float(aov.n[2])) + vec3(1e-8f));
+            depth[i] = aov.depth * invWeight;
+            hasNormal[i] = 1.0f;
+        }
+        vec3 demodulated = vec3(rgba[i]) / Max(a, vec3(1e-3f));
+        for (int c = 0; c < 3; c++) {
+            albedo[c][i] = a[c];
+            normal[c][i] = n[c];
+            color[c][i] = demodulated[c];
+        }
+    });
+
+    const float invSigmaAlbedo2 = 1.0f / pstd::sqr(sigmaAlbedo);
+    for (int iter = 0; iter < denoiseIterations; iter++) {
+        int step = 1 << iter;
+        float invSigmaColor2 = 1.0f / pstd::sqr(sigmaColor / step);
+        float depthScale = sigmaDepth * step;
+        ParallelFor(nPixels, [&](int i) {
+            luminance[i] = Luminance(vec3(color[0][i], color[1][i], color[2][i]));
+        });
+
+        ParallelFor(size.y, [&](int y) {
+            for (int x0 = 0; x0 < size.x; x0 += finalizeBlockSize) {
+                int x1 = pstd::min(x0 + finalizeBlockSize, size.x);
+                float sum[3][finalizeBlockSize] = {}, sumWeight[finalizeBlockSize] = {};
+
+                for (int dy = -2; dy <= 2; dy++) {
+                    int qy = y + dy * step;
+                    if (qy < 0 || qy >= size.y)
+                        continue;
+                    for (int dx = -2; dx <= 2; dx++) {
+                        // Pixels of the block whose tap lands inside the film
+                        int offset = (qy - y) * size.x + dx * step;
+                        int begin = pstd::max(x0, -dx * step);
+                        int end = pstd::min(x1, size.x - dx * step);
+                        float k = kernel[pstd::abs(dx)] * kernel[pstd::abs(dy)];
+
+                        for (int x = begin; x < end; x++) {
+                            int i = y * size.x + x, q = i + offset;
+                            float dc = pstd::sqr(luminance[i] - luminance[q]) /
+                                       (pstd::sqr(luminance[i]) + 1e-4f) * invSigmaColor2;
+                            float da = (pstd::sqr(albedo[0][i] - albedo[0][q]) +
+                                        pstd::sqr(albedo[1][i] - albedo[1][q]) +
+                                        pstd::sqr(albedo[2][i] - albedo[2][q])) *
+                                       invSigmaAlbedo2;
+                            float dz = pstd::abs(depth[i] - depth[q]) /
+                                       (depthScale * depth[i] + 1e-4f);
+                            float cosNormal = normal[0][i] * normal[0][q] +
+                                              normal[1][i] * normal[1][q] +
+                                              normal[2][i] * normal[2][q];
+                            // Blended rather than selected to keep the loop free of branches;
+                            // the clamp makes the power underflow to 0 for opposite normals
+                            float wn = FastExp2(normalExponent *
+                                                FastLog2(pstd::max(cosNormal, 1e-6f)));
+                            wn = 1.0f + hasNormal[i] * hasNormal[q] * (wn - 1.0f);
+
+                            float w = k * wn * FastExp2(-(dc + da + dz) * pstd::Log2E);
+                            for (int c = 0; c < 3; c++)
+                                sum[c][x - x0] += color[c][q] * w;
+                            sumWeight[x - x0] += w;
+                        }
+                    }
+                }
+
+                for (int x = x0; x < x1; x++)
+                    for (int c = 0; c < 3; c++)
+                        next[c][y * size.x + x] = sum[c][x - x0] / sumWeight[x - x0];
+            }
+        });
+        for (int c = 0; c < 3; c++)
+            pstd::swap(color[c], next[c]);
+    }
+
+    ParallelFor(nPixels, [&](int i) {
+        rgba[i] = vec4(color[0][i] * albedo[0][i], color[1][i] * albedo[1][i],
+                       color[2][i] * albedo[2][i], 1.0f);
+    });
 }
 
 }  // namespace pine
\ No newline at end of file
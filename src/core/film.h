@@ -3,10 +3,12 @@
 
 #include <core/spectrum.h>
 #include <core/filter.h>
+#include <util/distribution.h>
 #include <util/parallel.h>
 #include <util/profiler.h>
 
 #include <pstd/memory.h>
+#include <pstd/tuple.h>
 #include <atomic>
 #include <mutex>
 
@@ -18,19 +20,87 @@ struct Pixel {
     AtomicFloat weight;
 };
 
+struct AOVPixel {
+    AtomicFloat albedo[3];
+    AtomicFloat n[3];
+    AtomicFloat depth;
+    AtomicFloat weight;
+};
+
+struct AOVSample {
+    vec3 albedo;
+    vec3 n;
+    float depth = 0.0f;
+    bool valid = false;
+};
+
+struct FilmSample {
+    vec2 pFilm;
+    float weight = 1.0f;
+};
+
+struct TiledImageWriter;
+
+// Raw accumulation of a subset of the samples of a render, see MergeFilmShards()
+struct FilmShard {
+    PSTD_ARCHIVE(size, nSamples, applyToneMapping, cropWindow, cropBackground, accumulation)
+
+    vec2i size;
+    int nSamples = 0;
+    bool applyToneMapping = true;
+    vec4 cropWindow = vec4(0, 0, 1, 1);
+    // Characters of the background image path, kept as a vector to be archivable
+    pstd::vector<char> cropBackground;
+    pstd::vector<float> accumulation;
+};
+
+// Output and sampling settings of a Film; the defaults are those of a film block that sets nothing
+struct FilmOptions {
+    pstd::string outputFileName = "result.png";
+    bool applyToneMapping = true;
+    bool reportAverageColor = false;
+    bool importanceSampleFilter = false;
+    bool writeAOVs = false;
+    bool writeCost = false;
+    int denoiseIterations = 0;
+    int tileSize = 0;
+    vec4 cropWindow = vec4(0, 0, 1, 1);
+    pstd::string cropBackground;
+};
+
 struct Film {
     Film() = default;
-    Film(vec2i size, Filter filter, pstd::string outputFileName, bool applyToneMapping,
-         bool reportAverageColor);
+    Film(vec2i size, Filter filter, const FilmOptions& options);
+
+    FilmSample Sample(vec2i p, vec2 u) const {
+        if (!importanceSampleFilter)
+            return {(p + u) / size, 1.0f};
+
+        vec2 dir(1.0f);
+        for (int i = 0; i < 2; i++) {
+            if (u[i] < 0.5f) {
+                dir[i] = -1.0f;
+                u[i] = 2 * u[i];
+            } else {
+                u[i] = 2 * u[i] - 1;
+            }
+        }
+        float pdf;
+        vec2 x = filterDistribution.SampleContinuous(u, pdf);
+        vec2i pi = Min(vec2i(x * filterTableWidth), vec2i(filterTableWidth - 1));
+        float weight = filterTable[pi.y * filterTableWidth + pi.x] < 0.0f ? -1.0f : 1.0f;
+        return {(p + vec2(0.5f) + dir * x * filter.Radius()) / size, weight};
+    }
 
     void AddSample(vec2 pFilm, const Spectrum& sL) {
         SampledProfiler _(ProfilePhase::FilmAddSample);
+        Telemetry::Count(TelemetryCounter::Samples);
         pFilm *= size;
         pFilm -= vec2(0.5f);
         vec2i p0 = Ceil(pFilm - filter.Radius());
         vec2i p1 = Floor(pFilm + filter.Radius());
-        p0 = Max(p0, vec2i(0));
-        p1 = Min(p1, size - vec2i(1));
+        p0 = Max(p0, bufferOrigin);
+        p1 = Min(p1, bufferOrigin + bufferSize - vec2i(1));
         vec3 L = sL.ToRGB();
 
         for (int y = p0.y; y <= p1.y; y++)
@@ -43,10 +113,46 @@ struct Film {
                 pixel.weight.Add(weight);
             }
     }
+    void AddSample(vec2i p, const FilmSample& fs, const Spectrum& sL) {
+        if (!importanceSampleFilter)
+            return AddSample(fs.pFilm, sL);
+        if (!Inside(p, bufferOrigin, bufferOrigin + bufferSize))
+            return;
+        SampledProfiler _(ProfilePhase::FilmAddSample);
+        Telemetry::Count(TelemetryCounter::Samples);
+        vec3 L = sL.ToRGB();
+
+        Pixel& pixel = GetPixel(p);
+        pixel.rgb[0].Add(L[0] * fs.weight);
+        pixel.rgb[1].Add(L[1] * fs.weight);
+        pixel.rgb[2].Add(L[2] * fs.weight);
+        pixel.weight.Add(fs.weight);
+    }
+    void AddAOV(vec2i p, const AOVSample& aov) {
+        if (!aov.valid)
+            return;
+        AOVPixel& pixel = aovPixels[(size.y - 1 - p.y) * size.x + p.x];
+        for (int c = 0; c < 3; c++) {
+            pixel.albedo[c].Add(aov.albedo[c]);
+            pixel.n[c].Add(aov.n[c]);
+        }
+        pixel.depth.Add(aov.depth);
+        pixel.weight.Add(1.0f);
+    }
+    bool HasAOVs() const {
+        return (bool)aovPixels;
+    }
+    // Each pixel is computed by one thread at a time, so costs are accumulated without atomics
+    void AddCost(vec2i p, uint64_t cycles) {
+        pixelCosts[(size.y - 1 - p.y) * size.x + p.x] += cycles;
+    }
+    bool RecordsCost() const {
+        return (bool)pixelCosts;
+    }
     void AddSplat(vec2 pFilm, const Spectrum& sL) {
         SampledProfiler _(ProfilePhase::FilmAddSample);
         vec2i p = pFilm * size;
-        if (!Inside(p, vec2i(0), size))
+        if (!Inside(p, bufferOrigin, bufferOrigin + bufferSize))
             return;
         float xyz[3];
         sL.ToXYZ(xyz);
@@ -58,7 +164,8 @@ struct Film {
     }
 
     Pixel& GetPixel(vec2i p) {
-        return pixels[(size.y - 1 - p.y) * size.x + p.x];
+        p -= bufferOrigin;
+        return pixels[(bufferSize.y - 1 - p.y) * bufferSize.x + p.x];
     }
 
     vec2i Size() const {
@@ -68,33 +175,94 @@ struct Film {
         return (float)size.x / size.y;
     }
     void Clear();
-    void Finalize(float splatMultiplier = 1.0f);
+    pstd::vector<float> SaveAccumulation() const;
+    bool LoadAccumulation(const pstd::vector<float>& data);
+    FilmShard SaveShard(int nSamples) const {
+        pstd::vector<char> background(cropBackground.begin(), cropBackground.end());
+        return {size, nSamples, applyToneMapping, cropWindow, background, SaveAccumulation()};
+    }
+    void Finalize(float splatMultiplier = 1.0f, bool newFrame = true);
     void WriteToDisk(pstd::string_view filename) const;
+    // Display colors of the last Finalize() before they are quantized for the output file
+    pstd::vector<vec3> FinalizedImage() const;
+    pstd::string_view OutputFileName() const {
+        return outputFileName;
+    }
+
+    // Only pixels inside the crop window are rendered, the others are filled with the background
+    // image; SampleBounds() extends the crop window by the filter radius
+    pstd::pair<vec2i, vec2i> CropBounds() const {
+        return {cropMin, cropMax};
+    }
+    pstd::pair<vec2i, vec2i> SampleBounds() const;
+
+    // Tiled mode only keeps one tile in memory; returns the range of pixels whose samples
+    // contribute to `tile`, which includes an apron of the filter radius
+    bool IsTiled() const {
+        return tileSize > 0;
+    }
+    vec2i TileCount() const {
+        return (size + vec2i(tileSize - 1)) / tileSize;
+    }
+    pstd::pair<vec2i, vec2i> BeginTile(vec2i tile);
+    void EndTile(TiledImageWriter& writer, float splatMultiplier);
+    void DisableTiling();
 
   private:
     float GetFilterValue(vec2 p) {
         vec2i pi = filterTableWidth * Min(Abs(p) / filter.Radius(), vec2(OneMinusEpsilon));
         return filterTable[pi.y * filterTableWidth + pi.x];
     }
-    void CopyToRGBArray(float splatMultiplier);
-    void ApplyToneMapping();
-    void ApplyGammaCorrection();
+    void Allocate();
+    vec3 ResolveAndMap(float splatMultiplier);
+    vec2i FilterApron() const {
+        return Ceil(filter.Radius() + vec2(0.5f));
+    }
+    bool IsCropped() const {
+        return cropMin != vec2i(0) || cropMax != size;
+    }
+    void ResolveBlock(int first, int count, float splatMultiplier, float* r, float* g, float* b,
+                      vec3& sum);
+    void MapBlock(int first, int count, float* r, float* g, float* b);
+    void Denoise();
+    void WriteAOVsToDisk(pstd::string_view filename) const;
+    void WriteCostToDisk(pstd::string_view filename) const;
 
     vec2i size;
+    vec2i bufferOrigin;
+    vec2i bufferSize;
     Filter filter;
     pstd::shared_ptr<Pixel[]> pixels;
     pstd::shared_ptr<vec4[]> rgba;
+    pstd::shared_ptr<AOVPixel[]> aovPixels;
+    pstd::shared_ptr<uint64_t[]> pixelCosts;
+    pstd::shared_ptr<vec3u8[]> background;
 
+    static constexpr int finalizeBlockSize = 64;
     static constexpr int filterTableWidth = 16;
     float filterTable[filterTableWidth * filterTableWidth];
+    Distribution2D filterDistribution;
 
     pstd::string outputFileName;
     bool applyToneMapping = true;
     bool reportAverageColor = false;
+    bool importanceSampleFilter = false;
+    bool writeAOVs = false;
+    bool writeCost = false;
+    int denoiseIterations = 0;
+    int tileSize = 0;
+    vec3 tileColorSum;
+    vec4 cropWindow;
+    pstd::string cropBackground;
+    vec2i cropMin;
+    vec2i cropMax;
     int frameId = 0;
 };
 
 Film CreateFilm(const Parameters& params);
+// Sums the shards' accumulations and writes the image of all their samples; it matches a single
+// render up to the order in which concurrent splats were accumulated
+void MergeFilmShards(const pstd::vector<FilmShard>& shards, pstd::string outputFileName);
 
 }  // namespace pine
 
@@ -148,6 +148,151 @@ bool Sphere::Intersect(Ray& ray, Interaction& it) const {
 AABB Sphere::GetAABB() const {
     return {c - vec3(r), c + vec3(r)};
 }
+ShapeSample Sphere::Sample(vec3 p, vec2 u) const {
+    float dc2 = DistanceSquared(p, c);
+    if (dc2 <= r * r)
+        return Sample(u);
+
+    // Uniform in cos(theta) about the direction to the center; 1 - cos(thetaMax) rounds to 0 for
+    // small spheres, so a Taylor expansion is used below sin^2(1.5 degrees)
+    float sin2ThetaMax = r * r / dc2;
+    float sinThetaMax = pstd::sqrt(sin2ThetaMax);
+    float oneMinusCosThetaMax = 1.0f - SafeSqrt(1.0f - sin2ThetaMax);
+    float cosTheta = 1.0f - u.x * oneMinusCosThetaMax;
+    float sin2Theta = 1.0f - cosTheta * cosTheta;
+    if (sin2ThetaMax < 0.00068523f) {
+        sin2Theta = sin2ThetaMax * u.x;
+        cosTheta = pstd::sqrt(1.0f - sin2Theta);
+        oneMinusCosThetaMax = sin2ThetaMax / 2;
+    }
+
+    // Angle at the center between the direction to `p` and the sampled point
+    float cosAlpha = sin2Theta / sinThetaMax + cosTheta * SafeSqrt(1.0f - sin2Theta / sin2ThetaMax);
+    float sinAlpha = SafeSqrt(1.0f - cosAlpha * cosAlpha);
+    float phi = u.y * Pi * 2;
+
+    ShapeSample ss;
+    vec3 w = vec3(sinAlpha * pstd::cos(phi), sinAlpha * pstd::sin(phi), cosAlpha);
+    ss.n = CoordinateSystem(Normalize(p - c)) * w;
+    ss.p = OffsetRayOrigin(c + r * ss.n, ss.n);
+    ss.uv = CartesianToSpherical(ss.n);
+    ss.pdf = 1.0f / (Pi * 2 * oneMinusCosThetaMax);
+    return ss;
+}
+float Sphere::Pdf(vec3 p) const {
+    float dc2 = DistanceSquared(p, c);
+    if (dc2 <= r * r)
+        return 0.0f;
+    float sin2ThetaMax = r * r / dc2;
+    float oneMinusCosThetaMax = sin2ThetaMax < 0.00068523f
+                                    ? sin2ThetaMax / 2
+                                    : 1.0f - SafeSqrt(1.0f - sin2ThetaMax);
+    return 1.0f / (Pi * 2 * oneMinusCosThetaMax);
+}
+
+// Spherical triangles and rectangles lose precision below this solid angle, and their sampling
+// degenerates as they approach a hemisphere
+static constexpr float MinSphericalSampleArea = 3e-4f;
+static constexpr float MaxSphericalSampleArea = 6.22f;
+
+// Angle between vectors of any length, accurate for all angles
+static float AngleBetween(vec3 a, vec3 b) {
+    return pstd::abs(pstd::atan2(Length(Cross(a, b)), Dot(a, b)));
+}
+static vec3 GramSchmidt(vec3 v, vec3 w) {
+    return v - Dot(v, w) * w;
+}
+
+// Arvo, "Stratified Sampling of Spherical Triangles", with the vertices projected onto the unit
+// sphere around `p`
+struct SphericalTriangle {
+    SphericalTriangle(vec3 p, vec3 v0, vec3 v1, vec3 v2)
+        : a(Normalize(v0 - p)), b(Normalize(v1 - p)), c(Normalize(v2 - p)) {
+        // Van Oosterom and Strackee, "The Solid Angle of a Plane Triangle"
+        float det = pstd::abs(Dot(a, Cross(b, c)));
+        solidAngle = 2 * pstd::abs(pstd::atan2(det, 1 + Dot(a, b) + Dot(b, c) + Dot(c, a)));
+    }
+
+    vec3 Sample(vec2 u) const {
+        // The sub-triangle a, b, c' whose area is u.x of the whole one has c' on the arc from a
+        // to c, then the direction is uniform in 1 - cos(theta) along the arc from b to c'
+        float alpha = AngleBetween(Cross(a, b), -Cross(c, a));
+        float area = Pi + u.x * solidAngle;
+        float sinArea = pstd::sin(area), cosArea = pstd::cos(area);
+        float cosAlpha = pstd::cos(alpha), sinAlpha = pstd::sin(alpha);
+        float sinPhi = sinArea * cosAlpha - cosArea * sinAlpha;
+        float cosPhi = cosArea * cosAlpha + sinArea * sinAlpha;
+        float k1 = cosPhi + cosAlpha;
+        float k2 = sinPhi - sinAlpha * Dot(a, b);
+        float cosBp = (k2 + (k2 * cosPhi - k1 * sinPhi) * cosAlpha) /
+                      ((k2 * sinPhi + k1 * cosPhi) * sinAlpha);
+        cosBp = pstd::clamp(cosBp, -1.0f, 1.0f);
+        float sinBp = SafeSqrt(1.0f - cosBp * cosBp);
+        vec3 cp = cosBp * a + sinBp * Normalize(GramSchmidt(c, a));
+
+        float cosTheta = 1.0f - u.y * (1.0f - Dot(cp, b));
+        float sinTheta = SafeSqrt(1.0f - cosTheta * cosTheta);
+        return cosTheta * b + sinTheta * Normalize(GramSchmidt(cp, b));
+    }
+    bool IsSampleable() const {
+        return solidAngle >= MinSphericalSampleArea && solidAngle <= MaxSphericalSampleArea;
+    }
+
+    vec3 a, b, c;
+    float solidAngle = 0.0f;
+};
+
+// Urena et al., "An Area-Preserving Parametrization for Spherical Rectangles", for the rectangle
+// with corner `s` and orthonormal edges `ex` and `ey` seen from `o`, in the rectangle's frame
+struct SphericalRectangle {
+    SphericalRectangle(vec3 o, vec3 s, vec3 ex, vec3 ey, float lx, float ly) {
+        vec3 d = s - o;
+        z0 = Dot(d, Cross(ex, ey));
+        if (z0 == 0.0f)
+            return;
+        z0 = -pstd::abs(z0);
+        x0 = Dot(d, ex);
+        y0 = Dot(d, ey);
+        x1 = x0 + lx;
+        y1 = y0 + ly;
+
+        vec3 v00(x0, y0, z0), v01(x0, y1, z0), v10(x1, y0, z0), v11(x1, y1, z0);
+        vec3 n0 = Cross(v00, v10), n1 = Cross(v10, v11), n2 = Cross(v11, v01);
+        vec3 n3 = Cross(v01, v00);
+        float g0 = AngleBetween(-n0, n1);
+        float g1 = AngleBetween(-n1, n2);
+        float g2 = AngleBetween(-n2, n3);
+        float g3 = AngleBetween(-n3, n0);
+        b0 = n0.z / Length(n0);
+        b1 = n2.z / Length(n2);
+        k = Pi * 2 - g2 - g3;
+        solidAngle = pstd::max(g0 + g1 - k, 0.0f);
+    }
+
+    // Offset of the sampled point from the corner along `ex` and `ey`
+    vec2 Sample(vec2 u) const {
+        float au = u.x * solidAngle + k;
+        float fu = (pstd::cos(au) * b0 - b1) / pstd::sin(au);
+        float cu = (fu > 0.0f ? 1.0f : -1.0f) / pstd::sqrt(fu * fu + b0 * b0);
+        cu = pstd::clamp(cu, -OneMinusEpsilon, OneMinusEpsilon);
+        float xu = -(cu * z0) / SafeSqrt(1.0f - cu * cu);
+        xu = pstd::clamp(xu, x0, x1);
+
+        float d = pstd::sqrt(xu * xu + z0 * z0);
+        float h0 = y0 / pstd::sqrt(d * d + y0 * y0);
+        float h1 = y1 / pstd::sqrt(d * d + y1 * y1);
+        float hv = h0 + u.y * (h1 - h0), hv2 = hv * hv;
+        float yv = hv2 < 1.0f - 1e-6f ? (hv * d) / pstd::sqrt(1.0f - hv2) : y1;
+        return vec2(xu - x0, pstd::clamp(yv, y0, y1) - y0);
+    }
+    bool IsSampleable() const {
+        return solidAngle >= MinSphericalSampleArea && solidAngle <= MaxSphericalSampleArea;
+    }
+
+    float x0 = 0.0f, y0 = 0.0f, z0 = 0.0f, x1 = 0.0f, y1 = 0.0f;
+    float b0 = 0.0f, b1 = 0.0f, k = 0.0f;
+    float solidAngle = 0.0f;
+};
 
 AABB Triangle::GetAABB() const {
     AABB aabb;
@@ -156,6 +301,34 @@ AABB Triangle::GetAABB() const {
     aabb.Extend(v2);
     return aabb;
 }
+ShapeSample Triangle::Sample(vec3 p, vec2 u) const {
+    SphericalTriangle st(p, v0, v1, v2);
+    if (!st.IsSampleable())
+        return Sample(u);
+    vec3 w = st.Sample(u);
+
+    // Barycentrics of the point hit by the sampled direction
+    ShapeSample ss;
+    vec3 e1 = v1 - v0, e2 = v2 - v0;
+    vec3 s1 = Cross(w, e2);
+    float divisor = Dot(s1, e1);
+    if (divisor != 0.0f) {
+        vec3 s = p - v0;
+        float b1 = pstd::clamp(Dot(s, s1) / divisor, 0.0f, 1.0f);
+        float b2 = pstd::clamp(Dot(w, Cross(s, e1)) / divisor, 0.0f, 1.0f);
+        ss.uv = b1 + b2 > 1.0f ? vec2(b1, b2) / (b1 + b2) : vec2(b1, b2);
+    } else {
+        ss.uv = vec2(1.0f / 3.0f);
+    }
+    ss.n = Normal();
+    ss.p = OffsetRayOrigin(InterpolatePosition(ss.uv), ss.n);
+    ss.pdf = 1.0f / st.solidAngle;
+    return ss;
+}
+float Triangle::Pdf(vec3 p) const {
+    SphericalTriangle st(p, v0, v1, v2);
+    return st.IsSampleable() ? 1.0f / st.solidAngle : 0.0f;
+}
 
 bool Rect::Hit(const Ray& ray) const {
     float t = (Dot(position, n) - Dot(ray.o, n)) / Dot(ray.d, n);
@@ -201,6 +374,24 @@ AABB Rect::GetAABB() const {
     aabb.Extend(position - ey * ly / 2);
     return aabb;
 }
+ShapeSample Rect::Sample(vec3 p, vec2 u) const {
+    vec3 corner = position - ex * lx / 2 - ey * ly / 2;
+    SphericalRectangle sr(p, corner, ex, ey, lx, ly);
+    if (!sr.IsSampleable())
+        return Sample(u);
+    vec2 st = sr.Sample(u);
+
+    ShapeSample ss;
+    ss.n = n;
+    ss.uv = st / vec2(lx, ly);
+    ss.p = OffsetRayOrigin(corner + ex * st.x + ey * st.y, n);
+    ss.pdf = 1.0f / sr.solidAngle;
+    return ss;
+}
+float Rect::Pdf(vec3 p) const {
+    SphericalRectangle sr(p, position - ex * lx / 2 - ey * ly / 2, ex, ey, lx, ly);
+    return sr.IsSampleable() ? 1.0f / sr.solidAngle : 0.0f;
+}
 
 bool Cylinder::Hit(const Ray& ray) const {
     vec3 o = ray.o - pos, d = ray.d;
@@ -350,15 +541,36 @@ Rect Rect::Create(const Parameters& params) {
     return Rect(params.GetVec3("position"), params.GetVec3("ex"), params.GetVec3("ey"));
 }
 
+AABB TriangleMesh::GetAABB() const {
+    AABB aabb;
+    if (vertices)
+        for (vec3 v : *vertices)
+            aabb.Extend(v);
+    return aabb;
+}
+void TriangleMesh::BuildAreaDistribution() {
+    pstd::vector<float> areas(GetNumTriangles());
+    double sum = 0.0;
+    for (int i = 0; i < GetNumTriangles(); i++) {
+        areas[i] = GetTriangle(i).Area();
+        sum += areas[i];
+    }
+    area = sum;
+    if (areas.size())
+        areaDistribution = Distribution1D(&areas[0], (int)areas.size());
+}
+
 TriangleMesh TriangleMesh::Create(const Parameters& params) {
     TriangleMesh mesh = LoadObj(params.GetString("file"));
 
-    if (auto s = params.TryGetVec3("scale"))
-        for (auto& v : mesh.vertices)
-            v *= *s;
-    if (auto p = params.TryGetVec3("position"))
-        for (auto& v : mesh.vertices)
-            v += *p;
+    vec3 scale = params.GetVec3("scale", vec3(1.0f));
+    vec3 position = params.GetVec3("position", vec3(0.0f));
+    if (scale != vec3(1.0f) || position != vec3(0.0f)) {
+        pstd::vector<vec3> vertices = *mesh.vertices;
+        for (auto& v : vertices)
+            v = v * scale + position;
+        mesh.vertices = pstd::make_shared<pstd::vector<vec3>>(pstd::move(vertices));
+    }
 
     return mesh;
 }
@@ -389,6 +601,8 @@ Shape CreateShape(const Parameters& params, Scene* scene) {
             LOG_WARNING("[Shape][Create]Material \"&\" is not found", name);
         shape.material = *material;
     }
+    if (shape.Is<TriangleMesh>() && shape.GetLight())
+        shape.Be<TriangleMesh>().BuildAreaDistribution();
     if (auto name = params.TryGetString("medium")) {
         auto medium = Find(scene->mediums, *name);
         if (!medium)
@@ -109,7 +109,13 @@ struct AABB {
     vec3 upper = vec3(-FloatMax);
 };
 
+// Shapes that sample the solid angle they subtend set `pdf` with respect to it, otherwise it is
+// left at 0 and Shape::Sample() converts the area density
 struct ShapeSample : LightSample {
+    ShapeSample() {
+        pdf = 0.0f;
+    }
+
     vec3 p;
     vec3 n;
     vec2 uv;
@@ -130,7 +136,7 @@ struct Plane {
     float Area() const {
         return FloatMax;
     }
-    ShapeSample Sample(vec3, vec2) const {
+    ShapeSample Sample(vec2) const {
         LOG_FATAL("[Plane]doesn't support Sample()");
         return {};
     }
@@ -152,7 +158,7 @@ struct Sphere {
     float Area() const {
         return 4 * Pi * r * r;
     }
-    ShapeSample Sample(vec3, vec2 u) const {
+    ShapeSample Sample(vec2 u) const {
         ShapeSample ss;
         ss.n = UniformSphereSampling(u);
         ss.p = c + r * ss.n;
@@ -160,6 +166,9 @@ struct Sphere {
         ss.p = OffsetRayOrigin(ss.p, ss.n);
         return ss;
     }
+    // Samples the cone of directions to the visible cap, or the whole area from inside
+    ShapeSample Sample(vec3 p, vec2 u) const;
+    float Pdf(vec3 p) const;
 
     PSTD_ARCHIVE(c, r)
 
@@ -179,7 +188,7 @@ struct Cylinder {
     float Area() const {
         return height * Pi * 2 * r;
     }
-    ShapeSample Sample(vec3, vec2) const {
+    ShapeSample Sample(vec2) const {
         LOG_FATAL("[Cylinder]doesn't support Sample()");
         return {};
     }
@@ -205,7 +214,7 @@ struct Disk {
     float Area() const {
         return Pi * r * r;
     }
-    ShapeSample Sample(vec3, vec2) const {
+    ShapeSample Sample(vec2) const {
         LOG_FATAL("[Disk]doesn't support Sample()");
         return {};
     }
@@ -227,7 +236,7 @@ struct Line {
     float Area() const {
         return 0;
     }
-    ShapeSample Sample(vec3, vec2) const {
+    ShapeSample Sample(vec2) const {
         LOG_FATAL("[Line]doesn't support Sample()");
         return {};
     }
@@ -244,8 +253,14 @@ struct Triangle {
     bool Hit(const Ray& ray) const {
         return Hit(ray, v0, v1, v2);
     }
+    // The static version only finds `uv`, the rest is filled in here or by the BVH for meshes
     bool Intersect(Ray& ray, Interaction& it) const {
-        return Intersect(ray, it, v0, v1, v2);
+        if (!Intersect(ray, it, v0, v1, v2))
+            return false;
+        it.p = InterpolatePosition(it.uv);
+        it.n = Normal();
+        ComputeDpDuv(it.dpdu, it.dpdv);
+        return true;
     }
 
     static inline bool Hit(const Ray& ray, vec3 v0, vec3 v1, vec3 v2) {
@@ -315,7 +330,7 @@ struct Triangle {
     float Area() const {
         return Length(Cross(v1 - v0, v2 - v0)) / 2;
     }
-    ShapeSample Sample(vec3, vec2 u) const {
+    ShapeSample Sample(vec2 u) const {
         ShapeSample ss;
         if (u.x + u.y > 1.0f)
             u = vec2(1.0f) - u;
@@ -325,6 +340,10 @@ struct Triangle {
         ss.p = OffsetRayOrigin(ss.p, ss.n);
         return ss;
     }
+    // Samples the spherical triangle seen from `p`, or the area when its solid angle is too small
+    // or too large to be sampled accurately
+    ShapeSample Sample(vec3 p, vec2 u) const;
+    float Pdf(vec3 p) const;
 
     PSTD_ARCHIVE(v0, v1, v2)
 
@@ -348,7 +367,7 @@ struct Rect {
     float Area() const {
         return lx * ly;
     }
-    ShapeSample Sample(vec3, vec2 u) const {
+    ShapeSample Sample(vec2 u) const {
         ShapeSample ss;
         ss.p = position + ex * lx * (u.x - 0.5f) + ey * ly * (u.y - 0.5f);
         ss.n = n;
@@ -356,6 +375,9 @@ struct Rect {
         ss.p = OffsetRayOrigin(ss.p, n);
         return ss;
     }
+    // Samples the spherical rectangle seen from `p`, with the same fallback as Triangle
+    ShapeSample Sample(vec3 p, vec2 u) const;
+    float Pdf(vec3 p) const;
 
     vec3 position, ex, ey, n;
     float lx, ly;
@@ -364,7 +386,8 @@ struct Rect {
 struct TriangleMesh {
     static TriangleMesh Create(const Parameters& params);
     TriangleMesh() = default;
-    TriangleMesh(pstd::vector<vec3> vertices, pstd::vector<uint32_t> indices)
+    TriangleMesh(pstd::shared_ptr<pstd::vector<vec3>> vertices,
+                 pstd::shared_ptr<pstd::vector<uint32_t>> indices)
         : vertices(pstd::move(vertices)), indices(pstd::move(indices)){};
 
     bool Hit(const Ray&) const {
@@ -373,27 +396,23 @@ struct TriangleMesh {
     bool Intersect(Ray&, Interaction&) const {
         return false;
     }
-    AABB GetAABB() const {
-        return {};
-    }
+    AABB GetAABB() const;
+    // Only known once BuildAreaDistribution() was called
     float Area() const {
-        return {};
-    }
-    float Pdf(const Ray&, const Interaction&) const {
-        return {};
+        return area;
     }
 
     int GetNumTriangles() const {
-        return (int)indices.size() / 3;
+        return indices ? (int)indices->size() / 3 : 0;
     }
     Triangle GetTriangle(int index) const {
         CHECK_GE(index, 0);
-        CHECK_LT(index * 3 + 2, (int)indices.size());
-        CHECK_LT(indices[index * 3 + 0], (uint32_t)vertices.size());
-        CHECK_LT(indices[index * 3 + 1], (uint32_t)vertices.size());
-        CHECK_LT(indices[index * 3 + 2], (uint32_t)vertices.size());
-        return {vertices[indices[index * 3 + 0]], vertices[indices[index * 3 + 1]],
-                vertices[indices[index * 3 + 2]]};
+        CHECK_LT(index * 3 + 2, (int)indices->size());
+        const uint32_t* triangle = &(*indices)[index * 3];
+        CHECK_LT(triangle[0], (uint32_t)vertices->size());
+        CHECK_LT(triangle[1], (uint32_t)vertices->size());
+        CHECK_LT(triangle[2], (uint32_t)vertices->size());
+        return {(*vertices)[triangle[0]], (*vertices)[triangle[1]], (*vertices)[triangle[2]]};
     }
     pstd::vector<Triangle> ToTriangles() const {
         pstd::vector<Triangle> ts(GetNumTriangles());
@@ -401,15 +420,33 @@ struct TriangleMesh {
             ts[i] = GetTriangle(i);
         return ts;
     }
-    ShapeSample Sample(vec3, vec2) const {
-        LOG_FATAL("[TriangleMesh]doesn't support Sample()");
-        return {};
+    // Triangles are picked in proportion to their area, so the density is 1 / Area() over the
+    // whole mesh and does not depend on the triangle that was hit
+    void BuildAreaDistribution();
+    ShapeSample Sample(vec2 u) const {
+        float pdf;
+        int index = areaDistribution.SampleDiscreteAlias(u.x, pdf, &u.x);
+        return GetTriangle(index).Sample(u);
     }
 
-    pstd::vector<vec3> vertices;
+    // Shared by every mesh loaded from the same file, unless it was moved or scaled
+    pstd::shared_ptr<pstd::vector<vec3>> vertices;
     pstd::vector<vec3> normals;
     pstd::vector<vec2> texcoords;
-    pstd::vector<uint32_t> indices;
+    pstd::shared_ptr<pstd::vector<uint32_t>> indices;
+
+    Distribution1D areaDistribution;
+    float area = 0.0f;
+};
+
+template <typename T>
+struct HasSolidAngleSampling {
+    template <typename U>
+    static constexpr pstd::true_type Check(decltype(U().Pdf(vec3()))*);
+    template <typename U>
+    static constexpr pstd::false_type Check(...);
+
+    static constexpr bool value = decltype(Check<T>(0))::value;
 };
 
 struct Shape : TaggedVariant<Sphere, Plane, Triangle, Rect, Cylinder, Disk, Line, TriangleMesh> {
@@ -429,15 +466,37 @@ struct Shape : TaggedVariant<Sphere, Plane, Triangle, Rect, Cylinder, Disk, Line
     float Area() const {
         return Dispatch([&](auto&& x) { return x.Area(); });
     }
+    // Solid angle density of sampling the point hit by `ray` from its origin
     float Pdf(const Ray& ray, const Interaction& it) const {
+        float pdf = Dispatch([&](auto&& x) {
+            if constexpr (HasSolidAngleSampling<pstd::decay_t<decltype(x)>>::value)
+                return x.Pdf(ray.o);
+            else
+                return 0.0f;
+        });
+        if (pdf != 0.0f)
+            return pdf;
         return pstd::sqr(ray.tmax) / (AbsDot(-ray.d, it.n) * Area());
     }
     ShapeSample Sample(vec3 p, vec2 u) const {
-        ShapeSample ss = Dispatch([&](auto&& x) { return x.Sample(p, u); });
+        ShapeSample ss = Dispatch([&](auto&& x) {
+            if constexpr (HasSolidAngleSampling<pstd::decay_t<decltype(x)>>::value)
+                return x.Sample(p, u);
+            else
+                return x.Sample(u);
+        });
         ss.wo = Normalize(ss.p - p, ss.distance);
         if (material->Is<EmissiveMaterial>())
             ss.Le = material->Le({ss.p, ss.n, ss.uv, vec3(), vec3(), -ss.wo});
-        ss.pdf = pstd::sqr(ss.distance) / (AbsDot(-ss.wo, ss.n) * Area());
+        if (ss.pdf == 0.0f)
+            ss.pdf = pstd::sqr(ss.distance) / (AbsDot(-ss.wo, ss.n) * Area());
+        return ss;
+    }
+    // Uniform over the area, as needed to start light paths
+    ShapeSample SampleArea(vec2 u) const {
+        ShapeSample ss = Dispatch([&](auto&& x) { return x.Sample(u); });
+        if (material->Is<EmissiveMaterial>())
+            ss.Le = material->Le({ss.p, ss.n, ss.uv, vec3(), vec3(), ss.n});
         return ss;
     }
     pstd::optional<Light> GetLight() const {
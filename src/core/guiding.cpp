@@ -0,0 +1,155 @@
+#include <core/guiding.h>
+
+namespace pine {
+
+static vec2 DirectionToSquare(vec3 wo) {
+    float z = pstd::clamp(wo.z, -1.0f, 1.0f);
+    return Min(vec2(Phi2pi(wo.x, wo.y) / Pi2, (1.0f - z) / 2.0f), vec2(OneMinusEpsilon));
+}
+static vec3 SquareToDirection(vec2 u) {
+    float z = 1.0f - 2.0f * u.y;
+    float r = pstd::sqrt(pstd::max(1.0f - z * z, 0.0f));
+    float phi = u.x * Pi2;
+    return vec3(r * pstd::cos(phi), r * pstd::sin(phi), z);
+}
+
+DTree::DTree() : nodes(1), recordedNodes(1), recorded(new AtomicFloat[4]) {
+}
+
+vec3 DTree::Sample(vec2 u) const {
+    vec2 origin = vec2(0.0f);
+    float size = 1.0f;
+    for (int node = 0;;) {
+        const float* e = nodes[node].energy;
+        float sum = e[0] + e[1] + e[2] + e[3];
+        if (sum <= 0.0f)
+            break;
+
+        // Picks the column first then the cell within it, so each cell has probability e[i] / sum
+        float pLeft = (e[0] + e[2]) / sum;
+        int x = u.x < pLeft ? 0 : 1;
+        u.x = x == 0 ? u.x / pLeft : (u.x - pLeft) / (1.0f - pLeft);
+        float pBottom = e[x] / (e[x] + e[x + 2]);
+        int y = u.y < pBottom ? 0 : 1;
+        u.y = y == 0 ? u.y / pBottom : (u.y - pBottom) / (1.0f - pBottom);
+        u = Min(u, vec2(OneMinusEpsilon));
+
+        size /= 2;
+        origin += vec2(x, y) * size;
+        node = nodes[node].children[x + 2 * y];
+        if (node == 0)
+            break;
+    }
+    return SquareToDirection(origin + u * size);
+}
+float DTree::Pdf(vec3 wo) const {
+    vec2 p = DirectionToSquare(wo);
+    float pdf = 1.0f / (4 * Pi);
+    for (int node = 0;;) {
+        const float* e = nodes[node].energy;
+        float sum = e[0] + e[1] + e[2] + e[3];
+        if (sum <= 0.0f)
+            break;
+        int x = p.x >= 0.5f, y = p.y >= 0.5f;
+        pdf *= 4 * e[x + 2 * y] / sum;
+        p = p * 2 - vec2(x, y);
+        node = nodes[node].children[x + 2 * y];
+        if (node == 0)
+            break;
+    }
+    return pdf;
+}
+
+void DTree::Record(vec3 wo, float radiance) {
+    vec2 p = DirectionToSquare(wo);
+    for (int node = 0;;) {
+        int x = p.x >= 0.5f, y = p.y >= 0.5f;
+        recorded[node * 4 + x + 2 * y].Add(radiance);
+        p = p * 2 - vec2(x, y);
+        node = recordedNodes[node].children[x + 2 * y];
+        if (node == 0)
+            break;
+    }
+}
+void DTree::Refine(float threshold, int maxDepth) {
+    nodes = recordedNodes;
+    for (size_t i = 0; i < nodes.size(); i++)
+        for (int c = 0; c < 4; c++)
+            nodes[i].energy[c] = recorded[i * 4 + c];
+    total = nodes[0].energy[0] + nodes[0].energy[1] + nodes[0].energy[2] + nodes[0].energy[3];
+
+    // Cells of the sampling tree that are leaves are assumed to be uniform when subdivided
+    recordedNodes = pstd::vector<Node>(1);
+    auto Build = [&](auto& me, int dst, const float* energy, int src, int depth) -> void {
+        for (int c = 0; c < 4; c++) {
+            if (energy[c] <= threshold * total || depth >= maxDepth)
+                continue;
+            int child = src != -1 ? nodes[src].children[c] : 0;
+            float childEnergy[4];
+            for (int i = 0; i < 4; i++)
+                childEnergy[i] = child ? nodes[child].energy[i] : energy[c] / 4;
+
+            int index = recordedNodes.size();
+            recordedNodes.push_back({});
+            recordedNodes[dst].children[c] = index;
+            me(me, index, childEnergy, child ? child : -1, depth + 1);
+        }
+    };
+    if (total > 0.0f)
+        Build(Build, 0, nodes[0].energy, 0, 1);
+    recorded = pstd::shared_ptr<AtomicFloat[]>(new AtomicFloat[recordedNodes.size() * 4]);
+}
+
+SDTree::SDTree(AABB bounds)
+    : bounds(bounds), nodes(1), leaves(1), nSamples(new std::atomic<int>[1]()) {
+}
+
+int SDTree::Lookup(vec3 p) const {
+    vec3 x = Clamp((p - bounds.lower) / Max(bounds.Diagonal(), vec3(1e-6f)), vec3(0.0f),
+                   vec3(OneMinusEpsilon));
+    int node = 0;
+    while (nodes[node].children[0]) {
+        int axis = nodes[node].axis;
+        int half = x[axis] >= 0.5f;
+        x[axis] = x[axis] * 2 - half;
+        node = nodes[node].children[half];
+    }
+    return nodes[node].leaf;
+}
+void SDTree::Refine(int iteration) {
+    pstd::vector<int> counts(leaves.size());
+    for (size_t i = 0; i < leaves.size(); i++)
+        counts[i] = nSamples[i];
+
+    // Both halves start from a copy of the parent's tree and half of its samples, and are checked
+    // again as the loop reaches them
+    int threshold = spatialThreshold * pstd::sqrt(float(1 << iteration));
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (nodes[i].children[0] || counts[nodes[i].leaf] <= threshold)
+            continue;
+        // Copied first since push_back() may reallocate the storage they refer to; the halves
+        // record into their own arrays, so the copy does not share the parent's
+        int leaf = nodes[i].leaf;
+        counts[leaf] /= 2;
+        int count = counts[leaf];
+        DTree copy = leaves[leaf];
+        size_t nRecorded = copy.recordedNodes.size() * 4;
+        copy.recorded = pstd::shared_ptr<AtomicFloat[]>(new AtomicFloat[nRecorded]);
+        for (size_t r = 0; r < nRecorded; r++)
+            copy.recorded[r] = float(leaves[leaf].recorded[r]);
+        counts.push_back(count);
+        leaves.push_back(pstd::move(copy));
+
+        int axis = (nodes[i].axis + 1) % 3;
+        nodes[i].children[0] = nodes.size();
+        nodes.push_back({{}, leaf, axis});
+        nodes[i].children[1] = nodes.size();
+        nodes.push_back({{}, int(leaves.size() - 1), axis});
+    }
+
+    ParallelFor(int(leaves.size()),
+                [&](int i) { leaves[i].Refine(directionalThreshold, maxDepth); });
+    nSamples = pstd::shared_ptr<std::atomic<int>[]>(new std::atomic<int>[leaves.size()]());
+}
+
+}  // namespace pine
@@ -0,0 +1,79 @@
+#ifndef PINE_CORE_GUIDING_H
+#define PINE_CORE_GUIDING_H
+
+#include <core/geometry.h>
+#include <util/parallel.h>
+
+#include <pstd/vector.h>
+#include <pstd/memory.h>
+
+namespace pine {
+
+// Directional quadtree over the equal-area mapping of the sphere used by UniformSphereSampling,
+// so the share of energy of a cell is directly its probability; the sampling side is frozen
+// during an iteration while radiance is recorded into a separate topology that can be refined
+struct DTree {
+    struct Node {
+        float energy[4] = {};
+        int children[4] = {};
+    };
+
+    DTree();
+
+    vec3 Sample(vec2 u) const;
+    float Pdf(vec3 wo) const;
+    bool IsTrained() const {
+        return total > 0.0f;
+    }
+
+    // Thread-safe, the recorded topology is not modified until the end of the iteration
+    void Record(vec3 wo, float radiance);
+    // Makes the recorded energy the new sampling distribution and subdivides the cells holding
+    // more than `threshold` of it for the next iteration
+    void Refine(float threshold, int maxDepth);
+
+    pstd::vector<Node> nodes;
+    float total = 0.0f;
+
+    pstd::vector<Node> recordedNodes;
+    pstd::shared_ptr<AtomicFloat[]> recorded;
+};
+
+// Binary spatial tree over the scene bounds with a DTree in each leaf; leaves are split along
+// alternating axes once enough samples were recorded in them
+struct SDTree {
+    SDTree() = default;
+    SDTree(AABB bounds);
+
+    int Lookup(vec3 p) const;
+    const DTree& Leaf(int leaf) const {
+        return leaves[leaf];
+    }
+    // Thread-safe, also counts the samples that decide the spatial subdivision
+    void Record(int leaf, vec3 wo, float radiance) {
+        nSamples[leaf]++;
+        leaves[leaf].Record(wo, radiance);
+    }
+    // Called between iterations, splits the leaves that received more than `spatialThreshold`
+    // times sqrt(2^iteration) samples and refines every DTree in parallel
+    void Refine(int iteration);
+
+    struct Node {
+        int children[2] = {};
+        int leaf = 0;
+        int axis = 0;
+    };
+
+    AABB bounds;
+    pstd::vector<Node> nodes;
+    pstd::vector<DTree> leaves;
+    pstd::shared_ptr<std::atomic<int>[]> nSamples;
+
+    int maxDepth = 20;
+    float directionalThreshold = 0.01f;
+    int spatialThreshold = 12000;
+};
+
+}  // namespace pine
+
+#endif  // PINE_CORE_GUIDING_H
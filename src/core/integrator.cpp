@@ -2,9 +2,11 @@
 #include <core/sampling.h>
 #include <core/scene.h>
 #include <core/color.h>
+#include <core/guiding.h>
 #include <util/parallel.h>
 #include <util/profiler.h>
 #include <util/fileio.h>
+#include <util/assetcache.h>
 #include <impl/integrator/ao.h>
 #include <impl/integrator/viz.h>
 #include <impl/integrator/mlt.h>
@@ -35,11 +37,157 @@ Integrator* CreateIntegrator(const Parameters& params, Scene* scene) {
         }
     }
 }
-Integrator::Integrator(const Parameters& params, Scene* scene) : scene(scene) {
+RenderBudget::RenderBudget(const Parameters& params) {
+    timeBudget = params.GetFloat("timeBudget", 0.0f);
+    targetError = params.GetFloat("targetError", 0.0f);
+    writeInterval = params.GetFloat("writeInterval", 0.0f);
+    samplesPerPass = pstd::max(params.GetInt("samplesPerPass", 1), 1);
+}
+void RenderBudget::Start() {
+    timer.Reset();
+    writeTimer.Reset();
+}
+bool RenderBudget::IsExhausted(float error) {
+    if (timeBudget > 0.0f && ElapsedSeconds() >= timeBudget)
+        return true;
+    if (targetError > 0.0f && error <= targetError)
+        return true;
+    return false;
+}
+bool RenderBudget::ShouldWrite() {
+    if (writeInterval <= 0.0f || writeTimer.ElapsedMs() < writeInterval * 1000.0f)
+        return false;
+    writeTimer.Reset();
+    return true;
+}
+
+ConvergenceEstimator::ConvergenceEstimator(int nPixels)
+    : mean(nPixels), m2(nPixels), prevY(nPixels), prevWeight(nPixels), prevSplatY(nPixels) {
+}
+void ConvergenceEstimator::AddPass(Film& film, float splatMultiplier) {
+    auto [lower, upper] = film.CropBounds();
+    vec2i size = upper - lower;
+    ParallelFor(Area(size), [&](int i) {
+        Pixel& pixel = film.GetPixel(lower + vec2i(i % size.x, i / size.x));
+        float y = Luminance(vec3(float(pixel.rgb[0]), float(pixel.rgb[1]), float(pixel.rgb[2])));
+        float weight = pixel.weight;
+        float splatY = pixel.splatXYZ[1];
+
+        float value = (splatY - prevSplatY[i]) * splatMultiplier;
+        if (weight != prevWeight[i])
+            value += (y - prevY[i]) / (weight - prevWeight[i]);
+        prevY[i] = y;
+        prevWeight[i] = weight;
+        prevSplatY[i] = splatY;
+        Add(i, value);
+    });
+    EndPass();
+}
+float ConvergenceEstimator::RelativeError() const {
+    if (nPasses < 2)
+        return Infinity;
+
+    pstd::vector<double> sums(NumThreads());
+    ParallelFor((int)mean.size(), [&](int i) {
+        float variance = m2[i] / (nPasses - 1);
+        sums[threadIdx] += pstd::sqrt(variance / nPasses) / (pstd::abs(mean[i]) + 1e-2f);
+    });
+
+    double sum = 0.0;
+    for (double s : sums)
+        sum += s;
+    return sum / mean.size();
+}
+
+void ConvergenceEstimator::Rebase(Film& film) {
+    auto [lower, upper] = film.CropBounds();
+    vec2i size = upper - lower;
+    for (int i = 0; i < Area(size); i++) {
+        Pixel& pixel = film.GetPixel(lower + vec2i(i % size.x, i / size.x));
+        prevY[i] = Luminance(vec3(float(pixel.rgb[0]), float(pixel.rgb[1]), float(pixel.rgb[2])));
+        prevWeight[i] = pixel.weight;
+        prevSplatY[i] = pixel.splatXYZ[1];
+    }
+}
+
+Checkpointer::Checkpointer(const Parameters& params) {
+    filename = params.GetString("checkpointFile", "checkpoint.bin");
+    interval = params.GetFloat("checkpointInterval", 0.0f);
+}
+Checkpointer::~Checkpointer() {
+    Wait();
+}
+bool Checkpointer::ShouldSave() {
+    if (interval <= 0.0f || writing || timer.ElapsedMs() < interval * 1000.0f)
+        return false;
+    timer.Reset();
+    return true;
+}
+void Checkpointer::SaveAsync(RenderCheckpoint checkpoint) {
+    Wait();
+    writing = true;
+    writer = std::thread([this, checkpoint = pstd::move(checkpoint)]() {
+        auto data = Archive(key, checkpoint);
+        pstd::string temp = filename + ".tmp";
+        WriteBinaryData(temp, data.data(), data.size());
+        RenameFile(temp, filename);
+        writing = false;
+    });
+}
+void Checkpointer::Wait() {
+    if (writer.joinable())
+        writer.join();
+}
+pstd::optional<RenderCheckpoint> Checkpointer::Load() {
+    if (!resume)
+        return pstd::nullopt;
+    ScopedFile file(filename, pstd::ios::binary | pstd::ios::in);
+    if (!file.Success() || file.Size() == 0)
+        return pstd::nullopt;
+    pstd::vector<char> data(file.Size());
+    file.Read(&data[0], file.Size());
+    if (data.size() < Archive(key).size()) {
+        LOG_WARNING("[Checkpoint]\"&\" is truncated, starting over", filename);
+        return pstd::nullopt;
+    }
+
+    Deserializer deserializer(pstd::move(data));
+    auto saved = deserializer.Unarchive<CheckpointKey>();
+    if (saved.integrator != key.integrator) {
+        LOG_WARNING("[Checkpoint]\"&\" is from another integrator, starting over", filename);
+        return pstd::nullopt;
+    }
+    if (saved.filmSize != key.filmSize) {
+        LOG_WARNING("[Checkpoint]\"&\" has film size &, expect &, starting over", filename,
+                    saved.filmSize, key.filmSize);
+        return pstd::nullopt;
+    }
+    if (saved.samplesPerPixel != key.samplesPerPixel) {
+        LOG_WARNING("[Checkpoint]\"&\" is for & samples per pixel, expect &, starting over",
+                    filename, saved.samplesPerPixel, key.samplesPerPixel);
+        return pstd::nullopt;
+    }
+
+    auto checkpoint = deserializer.Unarchive<RenderCheckpoint>();
+    LOG("[Checkpoint]Resuming from \"&\" at pass &", filename, checkpoint.passIndex);
+    return checkpoint;
+}
+
+Integrator::Integrator(const Parameters& params, Scene* scene)
+    : scene(scene), budget(params), checkpointer(params) {
     film = &scene->camera.GetFilm();
     filmSize = scene->camera.GetFilm().Size();
 
     lightSampler = CreateLightSampler(params["lightSampler"], scene->lights);
+    shapeLightIndices.resize(scene->shapes.size());
+    pstd::fill(shapeLightIndices, -1);
+    for (int i = 0; i < (int)scene->lights.size(); i++) {
+        const Light& light = scene->lights[i];
+        if (light.Is<AreaLight>())
+            shapeLightIndices[light.Be<AreaLight>().shape - scene->shapes.data()] = i;
+        else if (light.Is<EnvironmentLight>())
+            envLightIndex = i;
+    }
 
     Parameters samplerParams = params["sampler"];
     samplerParams.Set("filmSize", filmSize);
@@ -47,20 +195,35 @@ Integrator::Integrator(const Parameters& params, Scene* scene) : scene(scene) {
     for (int i = 0; i < NumThreads() - 1; i++)
         samplers.push_back(samplers[0].Clone());
     samplesPerPixel = samplers[0].SamplesPerPixel();
+
+    pstd::string type = params.GetString("type");
+    checkpointer.key = {HashBuffer(type.data(), type.size()), filmSize, samplesPerPixel};
 }
 
-RayIntegrator::RayIntegrator(const Parameters& params, Scene* scene)
-    : Integrator(params, scene), accel(CreateAccel(params["accel"])) {
-    accel->Initialize(scene);
+float Integrator::LightChoicePdf(vec3 p, vec3 n, const Shape* shape) const {
+    int index = shape ? shapeLightIndices[shape - scene->shapes.data()] : envLightIndex;
+    return index != -1 ? lightSampler.Pdf(p, n, index) : 0.0f;
+}
+
+RayIntegrator::RayIntegrator(const Parameters& params, Scene* scene) : Integrator(params, scene) {
+    if (!scene->accel) {
+        scene->accel = pstd::shared_ptr<Accel>(CreateAccel(params["accel"]));
+        scene->accel->Initialize(scene);
+    }
+    accel = scene->accel;
     maxDepth = params.GetInt("maxDepth", 4);
+    lightCandidates = pstd::max(params.GetInt("lightCandidates", 1), 1);
+    aovSamples.resize(NumThreads());
 }
 bool RayIntegrator::Hit(Ray ray) const {
     SampledProfiler _(ProfilePhase::IntersectShadow);
+    Telemetry::Count(TelemetryCounter::ShadowRays);
 
     return accel->Hit(ray);
 }
 bool RayIntegrator::Intersect(Ray& ray, Interaction& it) const {
     SampledProfiler _(ProfilePhase::IntersectClosest);
+    Telemetry::Count(TelemetryCounter::ClosestRays);
 
     it.wi = -ray.d;
     return accel->Intersect(ray, it);
@@ -73,7 +236,9 @@ Spectrum RayIntegrator::IntersectTr(Ray ray, Sampler& sampler) const {
     Spectrum tr = Spectrum(1.0f);
 
     while (true) {
-        bool hitSurface = Intersect(ray, it);
+        Telemetry::Count(TelemetryCounter::ShadowRays);
+        it.wi = -ray.d;
+        bool hitSurface = accel->Intersect(ray, it);
         if (ray.medium)
             tr *= ray.medium->Tr(ray, sampler);
         if (hitSurface && it.material)
@@ -85,14 +250,20 @@ Spectrum RayIntegrator::IntersectTr(Ray ray, Sampler& sampler) const {
 
     return tr;
 }
-Spectrum RayIntegrator::EstimateDirect(Ray ray, Interaction it, Sampler& sampler) const {
+Spectrum RayIntegrator::EstimateDirect(Ray ray, Interaction it, Sampler& sampler,
+                                       const DTree* guide, float bsdfFraction) const {
     SampledProfiler _(ProfilePhase::EstimateDirect);
+    if (lightCandidates > 1)
+        return EstimateDirectRIS(ray, it, sampler);
 
     auto [light, lightPdf] = lightSampler.SampleLight(it.p, it.n, sampler.Get1D());
     if (!light)
         return Spectrum(0.0f);
     LightSample ls = light->Sample(it.p, sampler.Get2D());
     ls.pdf *= lightPdf;
+    // Also skips the back of one-sided emitters, whose edge-on samples have an infinite density
+    if (ls.Le.IsBlack())
+        return Spectrum(0.0f);
 
     Spectrum tr = IntersectTr(it.SpawnRay(ls.wo, ls.distance), sampler);
     if (tr.IsBlack())
@@ -103,8 +274,12 @@ Spectrum RayIntegrator::EstimateDirect(Ray ray, Interaction it, Sampler& sampler
     if (it.IsSurfaceInteraction()) {
         MaterialEvalCtx mc(it, -ray.d, ls.wo);
         f = it.material->F(mc) * AbsDot(ls.wo, it.n);
-        if (!ls.isDelta)
+        if (!ls.isDelta) {
             scatteringPdf = it.material->PDF(mc);
+            if (guide && guide->IsTrained())
+                scatteringPdf =
+                    bsdfFraction * scatteringPdf + (1.0f - bsdfFraction) * guide->Pdf(ls.wo);
+        }
     } else {
         float p = it.phaseFunction->P(-ray.d, ls.wo);
         f = Spectrum(p);
@@ -117,12 +292,71 @@ Spectrum RayIntegrator::EstimateDirect(Ray ray, Interaction it, Sampler& sampler
     else
         return tr * f * w * ls.Le / ls.pdf;
 }
+Spectrum RayIntegrator::EstimateDirectRIS(const Ray& ray, const Interaction& it,
+                                          Sampler& sampler) const {
+    LightSample chosen;
+    Spectrum chosenF;
+    float chosenTarget = 0.0f, weightSum = 0.0f;
+    for (int i = 0; i < lightCandidates; i++) {
+        // Every candidate consumes the same dimensions so the sampler stays stratified
+        float ul = sampler.Get1D();
+        vec2 u2 = sampler.Get2D();
+        float ur = sampler.Get1D();
+
+        auto [light, lightPdf] = lightSampler.SampleLight(it.p, it.n, ul);
+        if (!light)
+            continue;
+        LightSample ls = light->Sample(it.p, u2);
+        ls.pdf *= lightPdf;
+        if (ls.pdf == 0.0f)
+            continue;
+
+        Spectrum f;
+        if (it.IsSurfaceInteraction())
+            f = it.material->F(MaterialEvalCtx(it, -ray.d, ls.wo)) * AbsDot(ls.wo, it.n);
+        else
+            f = Spectrum(it.phaseFunction->P(-ray.d, ls.wo));
+        float target = Spectrum(f * ls.Le).y();
+        if (target <= 0.0f)
+            continue;
+
+        float weight = target / ls.pdf;
+        weightSum += weight;
+        if (ur * weightSum < weight) {
+            chosen = ls;
+            chosenF = f;
+            chosenTarget = target;
+        }
+    }
+    if (weightSum == 0.0f)
+        return Spectrum(0.0f);
+
+    Spectrum tr = IntersectTr(it.SpawnRay(chosen.wo, chosen.distance), sampler);
+    if (tr.IsBlack())
+        return Spectrum(0.0f);
+    return tr * chosenF * chosen.Le * (weightSum / (lightCandidates * chosenTarget));
+}
 
 void PixelIntegrator::Render() {
     Profiler _("Rendering");
+    if (shardCount > 1) {
+        film->DisableTiling();
+        film->Clear();
+        return RenderShard();
+    }
+    bool progressive = budget.IsProgressive() || checkpointer.IsActive();
+    if (film->IsTiled()) {
+        if (SupportsTiledFilm() && !progressive)
+            return RenderTiled();
+        film->DisableTiling();
+    }
     film->Clear();
+    if (progressive)
+        return RenderProgressive();
 
-    int total = Area(filmSize);
+    auto [lower, upper] = film->SampleBounds();
+    vec2i extent = upper - lower;
+    int total = Area(extent);
     int groupSize = pstd::max(total / 100, 1);
     int nGroups = (total + groupSize - 1) / groupSize;
 
@@ -135,26 +369,107 @@ void PixelIntegrator::Render() {
             index += i * groupSize;
             if (index >= total)
                 return;
-            vec2i p = {index % filmSize.x, index / filmSize.x};
-            Sampler& sampler = samplers[threadIdx];
-            sampler.StartPixel(p, 0);
-
-            for (int sampleIndex = 0; sampleIndex < samplesPerPixel; sampleIndex++) {
-                Compute(p, sampler);
-                sampler.StartNextSample();
-            }
+            ComputePixel(lower + vec2i(index % extent.x, index / extent.x), 0, samplesPerPixel);
         });
     }
 
     film->Finalize(1.0f / samplesPerPixel);
 }
+void PixelIntegrator::RenderTiled() {
+    vec2i nTiles = film->TileCount();
+    TiledImageWriter writer(film->OutputFileName(), filmSize);
+    auto [sampleMin, sampleMax] = film->SampleBounds();
+    int64_t total = Area(sampleMax - sampleMin);
+    ProgressReporter pr("Rendering", "Pixels", "Samples", total, samplesPerPixel);
+
+    for (int i = 0; i < Area(nTiles); i++) {
+        ScopedPR(pr, i * total / Area(nTiles), i + 1 == Area(nTiles));
+        auto [lower, upper] = film->BeginTile({i % nTiles.x, i / nTiles.x});
+        vec2i extent = upper - lower;
+
+        ParallelFor(Area(extent), [&](int index) {
+            ComputePixel(lower + vec2i(index % extent.x, index / extent.x), 0, samplesPerPixel);
+        });
+        film->EndTile(writer, 1.0f / samplesPerPixel);
+    }
+}
+void PixelIntegrator::RenderShard() {
+    int firstSample = int64_t(samplesPerPixel) * shardIndex / shardCount;
+    int nSamples = int64_t(samplesPerPixel) * (shardIndex + 1) / shardCount - firstSample;
+    auto [lower, upper] = film->SampleBounds();
+    LOG("[Rendering]Shard &/&, samples [&, &)", shardIndex, shardCount, firstSample,
+        firstSample + nSamples);
+
+    ParallelFor(upper - lower, [&](vec2i p) { ComputePixel(lower + p, firstSample, nSamples); });
+
+    pstd::string filename = AppendFileName(ChangeFileExtension(film->OutputFileName(), "shard"),
+                                           pstd::to_string("_", shardIndex));
+    Serialize(filename, film->SaveShard(nSamples));
+    LOG("[Rendering]Shard written to \"&\"", filename);
+}
+void PixelIntegrator::RenderProgressive() {
+    int maxSamples = budget.HasTimeLimit() ? pstd::numeric_limits<int>::max() : samplesPerPixel;
+    auto [cropMin, cropMax] = film->CropBounds();
+    auto [lower, upper] = film->SampleBounds();
+    ConvergenceEstimator estimator(Area(cropMax - cropMin));
+    budget.Start();
+
+    int sampleIndex = 0;
+    auto checkpoint = checkpointer.Load();
+    if (checkpoint && film->LoadAccumulation(checkpoint->film)) {
+        sampleIndex = checkpoint->passIndex;
+        estimator.Rebase(*film);
+    }
+
+    while (sampleIndex < maxSamples) {
+        int nSamples = pstd::min(budget.samplesPerPass, maxSamples - sampleIndex);
+        ParallelFor(upper - lower,
+                    [&](vec2i p) { ComputePixel(lower + p, sampleIndex, nSamples); });
+        sampleIndex += nSamples;
+
+        estimator.AddPass(*film, 1.0f / nSamples);
+        float error = estimator.RelativeError();
+        LOG_SAMELINE("[Rendering]Samples[&]  Time[&.1s]  Error[&.4]", sampleIndex,
+                     budget.ElapsedSeconds(), error);
+        if (budget.IsExhausted(error))
+            break;
+        if (budget.ShouldWrite())
+            film->Finalize(1.0f / sampleIndex, false);
+        if (checkpointer.ShouldSave())
+            checkpointer.SaveAsync({sampleIndex, film->SaveAccumulation(), {}});
+    }
+    LOG("[Rendering]& samples per pixel in &.1s", sampleIndex, budget.ElapsedSeconds());
+    if (checkpointer.interval > 0.0f)
+        checkpointer.SaveAsync({sampleIndex, film->SaveAccumulation(), {}});
+
+    film->Finalize(1.0f / sampleIndex);
+    checkpointer.Wait();
+}
+
+void PixelIntegrator::ComputePixel(vec2i p, int firstSample, int nSamples) {
+    Sampler& sampler = samplers[threadIdx];
+    sampler.StartPixel(p, firstSample);
+    uint64_t start = film->RecordsCost() ? CycleCount() : 0;
+
+    for (int i = 0; i < nSamples; i++) {
+        if (i != 0)
+            sampler.StartNextSample();
+        Compute(p, sampler);
+    }
+
+    if (film->RecordsCost())
+        film->AddCost(p, CycleCount() - start);
+}
 
 void RadianceIntegrator::Compute(vec2i p, Sampler& sampler) {
-    vec2 pFilm = (p + sampler.Get2D()) / film->Size();
-    Ray ray = scene->camera.GenRay(pFilm, sampler.Get2D());
+    FilmSample fs = film->Sample(p, sampler.Get2D());
+    Ray ray = scene->camera.GenRay(fs.pFilm, sampler.Get2D());
+    aovSamples[threadIdx] = {};
     auto L = Li(ray, sampler);
     if (!L.HasInfs() && !L.HasNaNs())
-        film->AddSample(pFilm, L);
+        film->AddSample(p, fs, L);
+    if (film->HasAOVs())
+        film->AddAOV(p, aovSamples[threadIdx]);
 }
 
 }  // namespace pine
\ No newline at end of file
@@ -7,11 +7,103 @@
 #include <core/accel.h>
 #include <core/film.h>
 
+#include <pstd/optional.h>
 #include <pstd/memory.h>
 #include <pstd/map.h>
+#include <thread>
+#include <atomic>
 
 namespace pine {
 
+struct RenderBudget {
+    RenderBudget(const Parameters& params);
+
+    bool IsProgressive() const {
+        return timeBudget > 0.0f || targetError > 0.0f || writeInterval > 0.0f;
+    }
+    bool HasTimeLimit() const {
+        return timeBudget > 0.0f;
+    }
+    void Start();
+    bool IsExhausted(float error);
+    bool ShouldWrite();
+    double ElapsedSeconds() {
+        return timer.ElapsedMs() / 1000.0;
+    }
+
+    float timeBudget = 0.0f;
+    float targetError = 0.0f;
+    float writeInterval = 0.0f;
+    int samplesPerPass = 1;
+
+  private:
+    Timer timer, writeTimer;
+};
+
+struct ConvergenceEstimator {
+    ConvergenceEstimator(int nPixels);
+
+    void AddPass(Film& film, float splatMultiplier);
+    void Add(int index, float value) {
+        float delta = value - mean[index];
+        mean[index] += delta / (nPasses + 1);
+        m2[index] += delta * (value - mean[index]);
+    }
+    void EndPass() {
+        nPasses++;
+    }
+    void Rebase(Film& film);
+    float RelativeError() const;
+
+    int nPasses = 0;
+
+  private:
+    pstd::vector<float> mean, m2;
+    pstd::vector<float> prevY, prevWeight, prevSplatY;
+};
+
+// Identifies the render a checkpoint was written by; a checkpoint is only resumed by a render
+// with the same key
+struct CheckpointKey {
+    PSTD_ARCHIVE(integrator, filmSize, samplesPerPixel)
+
+    uint64_t integrator = 0;
+    vec2i filmSize;
+    int64_t samplesPerPixel = 0;
+};
+
+struct RenderCheckpoint {
+    PSTD_ARCHIVE(passIndex, film, state)
+
+    int64_t passIndex = 0;
+    pstd::vector<float> film;
+    pstd::vector<char> state;
+};
+
+struct Checkpointer {
+    Checkpointer(const Parameters& params);
+    ~Checkpointer();
+    PINE_DELETE_COPY_MOVE(Checkpointer)
+
+    bool IsActive() const {
+        return interval > 0.0f || resume;
+    }
+    bool ShouldSave();
+    void SaveAsync(RenderCheckpoint checkpoint);
+    void Wait();
+    pstd::optional<RenderCheckpoint> Load();
+
+    pstd::string filename;
+    float interval = 0.0f;
+    bool resume = false;
+    CheckpointKey key;
+
+  private:
+    Timer timer;
+    std::thread writer;
+    std::atomic<bool> writing{false};
+};
+
 class Integrator {
   public:
     Integrator(const Parameters& params, Scene* scene);
@@ -19,7 +111,13 @@ class Integrator {
 
     virtual void Render() = 0;
 
+    // Probability of `lightSampler` choosing the light of `shape`, or the environment light if it
+    // is null, for a receiver at `p` with normal `n`; used by MIS when a light is hit by scattering
+    float LightChoicePdf(vec3 p, vec3 n, const Shape* shape) const;
+
     LightSampler lightSampler;
+    pstd::vector<int> shapeLightIndices;
+    int envLightIndex = -1;
 
     Scene* scene = nullptr;
     Film* film = nullptr;
@@ -27,19 +125,46 @@ class Integrator {
 
     pstd::vector<Sampler> samplers;
     int samplesPerPixel;
+
+    RenderBudget budget;
+    Checkpointer checkpointer;
+    int shardIndex = 0;
+    int shardCount = 1;
 };
 
 class RayIntegrator : public Integrator {
   public:
     RayIntegrator(const Parameters& params, Scene* scene);
 
+    void RecordAOV(vec3 albedo, vec3 n, float depth) {
+        if (!film->HasAOVs() || aovSamples[threadIdx].valid)
+            return;
+        aovSamples[threadIdx] = {albedo, n, depth, true};
+    }
+
     bool Hit(Ray ray) const;
     bool Intersect(Ray& ray, Interaction& it) const;
     Spectrum IntersectTr(Ray ray, Sampler& sampler) const;
-    Spectrum EstimateDirect(Ray ray, Interaction it, Sampler& sampler) const;
+    // With a trained `guide` that scattering also samples, the MIS weight uses the same mixture
+    // of the material and guide densities as the emission reached by scattering
+    Spectrum EstimateDirect(Ray ray, Interaction it, Sampler& sampler,
+                            const DTree* guide = nullptr, float bsdfFraction = 1.0f) const;
+    // Resampled importance sampling: `lightCandidates` light samples are weighted by their
+    // unshadowed contribution, one of them is kept by a weighted reservoir and only it is traced
+    Spectrum EstimateDirectRIS(const Ray& ray, const Interaction& it, Sampler& sampler) const;
+    // MIS weight of emission reached by scattering, with `lightPdf` including the probability of
+    // choosing the light; resampled direct lighting has no tractable pdf, so it alone accounts
+    // for the lights it can choose unless they are reached by specular scattering
+    float ScatteredEmissionWeight(float bsdfPdf, float lightPdf, bool specular) const {
+        if (lightCandidates > 1)
+            return specular || lightPdf == 0.0f ? 1.0f : 0.0f;
+        return PowerHeuristic(1, bsdfPdf, 1, lightPdf);
+    }
 
     pstd::shared_ptr<Accel> accel;
+    pstd::vector<AOVSample> aovSamples;
     int maxDepth;
+    int lightCandidates = 1;
 };
 
 class PixelIntegrator : public RayIntegrator {
@@ -47,7 +172,15 @@ class PixelIntegrator : public RayIntegrator {
     using RayIntegrator::RayIntegrator;
 
     void Render() override;
+    void RenderTiled();
+    void RenderShard();
+    void RenderProgressive();
+    // Computes samples [firstSample, firstSample + nSamples) of pixel `p`
+    void ComputePixel(vec2i p, int firstSample, int nSamples);
     virtual void Compute(vec2i p, Sampler& sampler) = 0;
+    virtual bool SupportsTiledFilm() const {
+        return false;
+    }
 };
 
 class RadianceIntegrator : public PixelIntegrator {
@@ -55,6 +188,9 @@ class RadianceIntegrator : public PixelIntegrator {
     using PixelIntegrator::PixelIntegrator;
 
     void Compute(vec2i p, Sampler& sampler) override;
+    bool SupportsTiledFilm() const override {
+        return true;
+    }
     virtual Spectrum Li(Ray ray, Sampler& sampler) = 0;
 };
 
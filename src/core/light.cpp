@@ -3,6 +3,9 @@
 #include <core/geometry.h>
 #include <core/sampling.h>
 #include <util/parameters.h>
+#include <util/parallel.h>
+#include <util/fileio.h>
+#include <util/rng.h>
 
 namespace pine {
 
@@ -45,7 +48,7 @@ LightSample AreaLight::Sample(vec3 p, vec2 u) const {
 }
 LightLeSample AreaLight::SampleLe(vec2 up, vec2 ud) const {
     LightLeSample les;
-    auto ss = shape->Sample({}, up);
+    auto ss = shape->SampleArea(up);
     les.ray = Ray(ss.p, CoordinateSystem(ss.n) * CosineWeightedSampling(ud));
     les.pdf.dir = AbsDot(les.ray.d, ss.n) / Pi;
     les.pdf.pos = 1.0f / shape->Area();
@@ -59,73 +62,159 @@ SpatialPdf AreaLight::PdfLe(const Ray&) const {
     return pdf;
 }
 Spectrum AreaLight::Power() const {
-    return shape->Area() * shape->material->Le(MaterialEvalCtx({}, {}, {}, {}, {}, {}));
+    // Emission is evaluated along the normal, uniform textures give the exact power
+    MaterialEvalCtx mc(vec3(0.0f), vec3(0, 0, 1), vec2(0.5f), {}, {}, vec3(0, 0, 1));
+    return Pi * shape->Area() * shape->material->Le(mc);
 }
 
-LightSample Sky::Sample(vec3, vec2) const {
+// Same mapping as UniformSphereSampling() and InverseUniformSphereMampling() without the costly
+// acos()
+static vec3 EqualAreaToDirection(vec2 uv) {
+    float z = 1.0f - 2.0f * uv.y;
+    float r = pstd::sqrt(pstd::max(1.0f - z * z, 0.0f));
+    float phi = uv.x * Pi2;
+    return vec3(r * pstd::cos(phi), r * pstd::sin(phi), z);
+}
+static vec2 DirectionToEqualArea(vec3 wo) {
+    return Min(vec2(Phi2pi(wo.x, wo.y) / Pi2, (1.0f - wo.z) / 2.0f), vec2(OneMinusEpsilon));
+}
+
+// The sun is picked in proportion to its share of the irradiance on a surface facing it, the
+// sky's being about Pi times its radiance averaged over the sphere
+static float SunProbability(float sunLuminance, float average) {
+    float sun = pstd::max(sunLuminance, 0.0f), sky = Pi * average;
+    return sun + sky > 0.0f ? pstd::min(sun / (sun + sky), OneMinusEpsilon) : 0.5f;
+}
+
+Sky::Sky(vec3 sundir, Spectrum suncol, int size)
+    : sunDirection(Normalize(sundir)), sunColor(suncol) {
+    colors.resize(pstd::max(size, 2));
+    pstd::vector<float> func(colors.size());
+    for (int i = 0; i < (int)colors.size(); i++) {
+        float y = 1.0f - 2.0f * (i + 0.5f) / colors.size();
+        vec3 wo = vec3(pstd::sqrt(1.0f - y * y), y, 0.0f);
+        colors[i] = SkyColor(wo, sunDirection, sunColor.ToRGB()).ToRGB();
+        func[i] = pstd::max(Luminance(colors[i]), 0.0f);
+    }
+    distribution = Distribution1D(&func[0], (int)func.size());
+    pSun = SunProbability(SkyColor(sunDirection, sunDirection, sunColor.ToRGB()).y(),
+                          distribution.funcInt);
+}
+
+LightSample Sky::Sample(vec3, vec2 u) const {
     LightSample ls;
     ls.distance = 1e+10f;
-    ls.isDelta = true;
-    ls.wo = sunDirection;
-    ls.Le = SkyColor(ls.wo, sunDirection, sunColor.ToRGB());
-    ls.pdf = 1.0f;
+    if (u.x < pSun) {
+        ls.wo = sunDirection;
+        ls.pdf = pSun;
+        ls.Le = SkyColor(ls.wo, sunDirection, sunColor.ToRGB());
+        ls.isDelta = true;
+    } else {
+        u.x = (u.x - pSun) / (1.0f - pSun);
+        float y = 1.0f - 2.0f * distribution.SampleContinuous(u.y, ls.pdf);
+        float r = pstd::sqrt(pstd::max(1.0f - y * y, 0.0f));
+        float phi = u.x * Pi2;
+        ls.wo = vec3(r * pstd::cos(phi), y, r * pstd::sin(phi));
+        ls.pdf *= (1.0f - pSun) / Pi4;
+        ls.Le = Color(ls.wo);
+    }
     return ls;
 }
 Spectrum Sky::Color(vec3 wo) const {
-    return SkyColor(wo, sunDirection, sunColor.ToRGB());
+    int n = (int)colors.size();
+    float t = (1.0f - wo.y) / 2.0f * n - 0.5f;
+    int i = pstd::clamp(int(pstd::floor(t)), 0, n - 2);
+    return pstd::lerp(pstd::clamp(t - i, 0.0f, 1.0f), colors[i], colors[i + 1]);
 }
-float Sky::Pdf(vec3) const {
-    return 0.0f;
+float Sky::Pdf(vec3 wo) const {
+    return distribution.Pdf((1.0f - wo.y) / 2.0f) * (1.0f - pSun) / Pi4;
 }
 
-Atmosphere::Atmosphere(vec3 sundir, Spectrum suncol, vec2i size, bool interpolate)
+Atmosphere::Atmosphere(vec3 sundir, Spectrum suncol, vec2i size, bool interpolate,
+                       pstd::string_view cacheDirectory)
     : sunDirection(Normalize(sundir)), sunColor(suncol), size(size), interpolate(interpolate) {
-    colors.resize(Area(size));
-    for (int y = 0; y < size.y; y++) {
-        for (int x = 0; x < size.x; x++) {
-            vec3 d = UniformSphereSampling(vec2((float)x / size.x, (float)y / size.y));
+    // The table only depends on these, so it can be reused by any scene with the same sky
+    pstd::string cacheFile;
+    if (cacheDirectory.size())
+        cacheFile = pstd::string(cacheDirectory) + "/atmosphere-" +
+                    pstd::to_string(Hash(sunDirection, sunColor.ToRGB(), size)) + ".bin";
+    if (cacheFile.size() && IsFileExist(cacheFile)) {
+        colors = Deserialize<pstd::vector<vec3>>(cacheFile);
+        if ((int)colors.size() == Area(size))
+            LOG("[Atmosphere]Loaded \"&\"", cacheFile);
+        else
+            colors.clear();
+    }
+    if (colors.size() == 0) {
+        Timer timer;
+        colors.resize(Area(size));
+        ParallelFor(size, [&](vec2i p) {
+            vec3 d = UniformSphereSampling(vec2(p) / size);
             vec3 color = AtmosphereColor(d, sunDirection, sunColor.ToRGB()).ToRGB();
-            colors[y * size.x + x] = color.HasNaN() ? vec3(0.0f) : color;
-        }
+            colors[p.y * size.x + p.x] = color.HasNaN() ? vec3(0.0f) : color;
+        });
+        LOG("[Atmosphere]Baked &x& table in &.2s", size.x, size.y, timer.ElapsedMs() / 1000.0);
+        if (cacheFile.size())
+            Serialize(cacheFile, colors);
     }
     sunSampledColor = AtmosphereColor(sunDirection, sunDirection, sunColor.ToRGB());
+
+    // Interpolated cells blend their four corners, so their average keeps the density nonzero
+    // wherever Color() is
+    pstd::vector<float> func(Area(size));
+    for (int y = 0; y < size.y; y++)
+        for (int x = 0; x < size.x; x++) {
+            float lum = Luminance(colors[y * size.x + x]);
+            if (interpolate) {
+                int x1 = (x + 1) % size.x, y1 = (y + 1) % size.y;
+                lum = (lum + Luminance(colors[y * size.x + x1]) +
+                       Luminance(colors[y1 * size.x + x]) + Luminance(colors[y1 * size.x + x1])) /
+                      4;
+            }
+            func[y * size.x + x] = pstd::max(lum, 0.0f);
+        }
+    distribution = Distribution2D(&func[0], size.x, size.y);
+    pSun = SunProbability(sunSampledColor.y(), distribution.pMarginal.funcInt);
 }
 
 LightSample Atmosphere::Sample(vec3, vec2 u) const {
     LightSample ls;
     ls.distance = 1e+10f;
-    if (u.x < 0.5f) {
-        u.x *= 2.0f;
-        ls.wo = UniformSphereSampling(u);
-        ls.pdf = 1.0f / Pi4;
-        vec2i st = Min(u * size, size - vec2(1));
-        ls.Le = colors[st.y * size.x + st.x];
-    } else {
+    if (u.x < pSun) {
         ls.wo = sunDirection;
-        ls.pdf = 1.0f;
+        ls.pdf = pSun;
         ls.Le = sunSampledColor.ToRGB();
         ls.isDelta = true;
+    } else {
+        u.x = (u.x - pSun) / (1.0f - pSun);
+        vec2 uv = distribution.SampleContinuous(Min(u, vec2(OneMinusEpsilon)), ls.pdf);
+        ls.wo = EqualAreaToDirection(uv);
+        ls.pdf *= (1.0f - pSun) / Pi4;
+        ls.Le = Lookup(uv);
     }
-    ls.pdf /= 2;
 
     return ls;
 }
 
 Spectrum Atmosphere::Color(vec3 wo) const {
-    vec2 uv = InverseUniformSphereMampling(wo) * size;
+    return Lookup(DirectionToEqualArea(wo));
+}
+float Atmosphere::Pdf(vec3 wo) const {
+    return distribution.Pdf(DirectionToEqualArea(wo)) * (1.0f - pSun) / Pi4;
+}
+Spectrum Atmosphere::Lookup(vec2 uv) const {
+    uv *= size;
     if (!interpolate) {
         vec2i st = Min(uv, size - vec2(1));
         return colors[st.y * size.x + st.x];
     }
+    // Wraps around in azimuth but not across the poles
     vec2i st00 = {pstd::floor(uv.x), pstd::floor(uv.y)};
-    vec2i st01 = {pstd::ceil(uv.x), pstd::floor(uv.y)};
-    vec2i st10 = {pstd::floor(uv.x), pstd::ceil(uv.y)};
-    vec2i st11 = {pstd::ceil(uv.x), pstd::ceil(uv.y)};
-    st00 %= size;
-    st01 %= size;
-    st10 %= size;
-    st11 %= size;
     vec2 p = uv - st00;
+    st00 = Min(st00, size - vec2i(1));
+    vec2i st11 = {(st00.x + 1) % size.x, pstd::min(st00.y + 1, size.y - 1)};
+    vec2i st01 = {st11.x, st00.y};
+    vec2i st10 = {st00.x, st11.y};
     vec3 c00 = colors[st00.y * size.x + st00.x];
     vec3 c01 = colors[st01.y * size.x + st01.x];
     vec3 c10 = colors[st10.y * size.x + st10.x];
@@ -134,9 +223,6 @@ Spectrum Atmosphere::Color(vec3 wo) const {
     vec3 c1 = pstd::lerp(p.x, c10, c11);
     return pstd::lerp(p.y, c0, c1);
 }
-float Atmosphere::Pdf(vec3) const {
-    return 1.0f / Pi4;
-}
 
 PointLight PointLight::Create(const Parameters& params) {
     return PointLight(params.GetVec3("position"), params.GetVec3("color"));
@@ -147,12 +233,14 @@ DirectionalLight DirectionalLight::Create(const Parameters& params) {
 }
 
 Sky Sky::Create(const Parameters& params) {
-    return Sky(params.GetVec3("sunDirection"), params.GetVec3("sunColor"));
+    return Sky(params.GetVec3("sunDirection"), params.GetVec3("sunColor"),
+               params.GetInt("size", 1024));
 }
 Atmosphere Atmosphere::Create(const Parameters& params) {
     return Atmosphere(params.GetVec3("sunDirection", vec3(2, 6, 3)),
-                      params.GetVec3("sunColor", vec3(1.0f)), params.GetVec2i("size", vec2i(512)),
-                      params.GetBool("interpolate", true));
+                      params.GetVec3("sunColor", vec3(1.0f)),
+                      params.GetVec2i("size", vec2i(1024, 512)),
+                      params.GetBool("interpolate", true), params.GetString("cacheDirectory", ""));
 }
 
 EnvironmentLight EnvironmentLight::Create(const Parameters& lightParams) {
@@ -4,6 +4,7 @@
 #include <core/spectrum.h>
 #include <core/sampling.h>
 #include <core/ray.h>
+#include <util/distribution.h>
 #include <util/taggedvariant.h>
 #include <util/profiler.h>
 
@@ -79,11 +80,11 @@ struct AreaLight {
     const Shape* shape = nullptr;
 };
 
+// Environment lights pick the sun with probability `pSun` and otherwise sample their table by
+// luminance
 struct Sky {
     static Sky Create(const Parameters& params);
-    Sky(vec3 sunDirection, Spectrum sunColor)
-        : sunDirection(Normalize(sunDirection)), sunColor(sunColor) {
-    }
+    Sky(vec3 sunDirection, Spectrum sunColor, int size);
 
     LightSample Sample(vec3 p, vec2 u2) const;
     Spectrum Color(vec3 wo) const;
@@ -103,11 +104,19 @@ struct Sky {
 
     vec3 sunDirection;
     Spectrum sunColor;
+    // The color only depends on the elevation, so it is baked over (1 - y) / 2 and interpolated
+    // linearly; the distribution samples the same bands
+    pstd::vector<vec3> colors;
+    Distribution1D distribution;
+    float pSun = 0.5f;
 };
 
 struct Atmosphere {
     static Atmosphere Create(const Parameters& params);
-    Atmosphere(vec3 sunDirection, Spectrum sunColor, vec2i size, bool interpolate);
+    // The table is baked in parallel, or loaded from `cacheDirectory` if it was saved there by a
+    // previous run with the same sun and size
+    Atmosphere(vec3 sunDirection, Spectrum sunColor, vec2i size, bool interpolate,
+               pstd::string_view cacheDirectory = {});
 
     LightSample Sample(vec3 p, vec2 u2) const;
     Spectrum Color(vec3 wo) const;
@@ -130,7 +139,13 @@ struct Atmosphere {
     Spectrum sunSampledColor;
     vec2i size;
     pstd::vector<vec3> colors;
+    // Indexed like `colors` by the equal-area mapping of UniformSphereSampling()
+    Distribution2D distribution;
+    float pSun = 0.5f;
     bool interpolate = true;
+
+  private:
+    Spectrum Lookup(vec2 uv) const;
 };
 
 struct EnvironmentLight : TaggedVariant<Atmosphere, Sky> {
@@ -16,6 +16,9 @@ SampledLight UniformLightSampler::SampleLight(float ul) const {
     sl.pdf = 1.0f / (int)lights.size();
     return sl;
 }
+float UniformLightSampler::Pdf(vec3, vec3, int) const {
+    return 1.0f / (int)lights.size();
+}
 
 PowerLightSampler::PowerLightSampler(const pstd::vector<Light>& lights) : lights(lights) {
     pstd::vector<float> lightPower;
@@ -29,9 +32,308 @@ SampledLight PowerLightSampler::SampleLight(vec3, vec3, float ul) const {
 }
 SampledLight PowerLightSampler::SampleLight(float ul) const {
     SampledLight sl;
-    sl.light = &lights[powerDistr.SampleDiscrete(ul, sl.pdf)];
+    sl.light = &lights[powerDistr.SampleDiscreteAlias(ul, sl.pdf)];
+    return sl;
+}
+float PowerLightSampler::Pdf(vec3, vec3, int index) const {
+    return powerDistr.Pdf((index + 0.5f) / powerDistr.Count()) / powerDistr.Count();
+}
+
+// cos(max(0, a - b)) and sin(max(0, a - b)) from the sines and cosines of a and b
+static float CosSubClamped(float sinA, float cosA, float sinB, float cosB) {
+    return cosA > cosB ? 1.0f : cosA * cosB + sinA * sinB;
+}
+static float SinSubClamped(float sinA, float cosA, float sinB, float cosB) {
+    return cosA > cosB ? 0.0f : sinA * cosB - cosA * sinB;
+}
+
+LightBounds::LightBounds(const Light& light) {
+    phi = light.Power().y();
+    if (light.Is<PointLight>()) {
+        bounds = AABB(light.Be<PointLight>().position);
+        cosThetaO = -1.0f;
+        cosThetaE = 0.0f;
+    } else if (light.Is<AreaLight>()) {
+        const Shape& shape = *light.Be<AreaLight>().shape;
+        bounds = shape.GetAABB();
+        cosThetaE = 0.0f;
+        // Planar shapes emit around their normal, on either side since shading normals can flip
+        if (shape.Is<Rect>()) {
+            w = shape.Be<Rect>().n;
+            twoSided = true;
+        } else if (shape.Is<Triangle>()) {
+            w = shape.Be<Triangle>().Normal();
+            twoSided = true;
+        } else if (shape.Is<Disk>()) {
+            w = Normalize(shape.Be<Disk>().n);
+            twoSided = true;
+        } else {
+            cosThetaO = -1.0f;
+        }
+    }
+}
+
+float LightBounds::Importance(vec3 p, vec3 n) const {
+    vec3 pc = bounds.Centroid();
+    float d2 = DistanceSquared(p, pc);
+    d2 = pstd::max(d2, Length(bounds.Diagonal()) / 2);
+
+    float cosThetaW = Dot(w, Normalize(p - pc));
+    if (twoSided)
+        cosThetaW = pstd::abs(cosThetaW);
+    float sinThetaW = SafeSqrt(1.0f - pstd::sqr(cosThetaW));
+
+    // Half-angle of the cone of directions from `p` to the bounds
+    float cosThetaB = -1.0f;
+    if (!Inside(p, bounds.lower, bounds.upper)) {
+        float sin2ThetaMax = LengthSquared(bounds.Diagonal() / 2) / DistanceSquared(p, pc);
+        if (sin2ThetaMax < 1.0f)
+            cosThetaB = SafeSqrt(1.0f - sin2ThetaMax);
+    }
+    float sinThetaB = SafeSqrt(1.0f - pstd::sqr(cosThetaB));
+
+    // Smallest angle between the emission cone and the direction to `p`
+    float sinThetaO = SafeSqrt(1.0f - pstd::sqr(cosThetaO));
+    float cosThetaX = CosSubClamped(sinThetaW, cosThetaW, sinThetaO, cosThetaO);
+    float sinThetaX = SinSubClamped(sinThetaW, cosThetaW, sinThetaO, cosThetaO);
+    float cosThetaP = CosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+    if (cosThetaP <= cosThetaE)
+        return 0.0f;
+    float importance = phi * cosThetaP / d2;
+
+    if (n != vec3(0.0f)) {
+        float cosThetaI = AbsDot(Normalize(pc - p), n);
+        float sinThetaI = SafeSqrt(1.0f - pstd::sqr(cosThetaI));
+        importance *= CosSubClamped(sinThetaI, cosThetaI, sinThetaB, cosThetaB);
+    }
+    return pstd::max(importance, 0.0f);
+}
+
+LightBounds Union(const LightBounds& a, const LightBounds& b) {
+    if (a.phi == 0.0f)
+        return b;
+    if (b.phi == 0.0f)
+        return a;
+    LightBounds lb;
+    lb.bounds = Union(a.bounds, b.bounds);
+    lb.phi = a.phi + b.phi;
+    lb.cosThetaE = pstd::min(a.cosThetaE, b.cosThetaE);
+    lb.twoSided = a.twoSided || b.twoSided;
+
+    // Smallest cone containing both cones
+    float thetaA = pstd::acos(pstd::clamp(a.cosThetaO, -1.0f, 1.0f));
+    float thetaB = pstd::acos(pstd::clamp(b.cosThetaO, -1.0f, 1.0f));
+    float thetaD = pstd::acos(pstd::clamp(Dot(a.w, b.w), -1.0f, 1.0f));
+    if (pstd::min(thetaD + thetaB, Pi) <= thetaA) {
+        lb.w = a.w;
+        lb.cosThetaO = a.cosThetaO;
+        return lb;
+    }
+    if (pstd::min(thetaD + thetaA, Pi) <= thetaB) {
+        lb.w = b.w;
+        lb.cosThetaO = b.cosThetaO;
+        return lb;
+    }
+    float thetaO = (thetaA + thetaD + thetaB) / 2;
+    vec3 axis = Cross(a.w, b.w);
+    if (thetaO >= Pi || LengthSquared(axis) == 0.0f) {
+        lb.cosThetaO = -1.0f;
+        return lb;
+    }
+    // Rotates a.w towards b.w, which is perpendicular to the rotation axis
+    float thetaR = thetaO - thetaA;
+    lb.w = Normalize(a.w * pstd::cos(thetaR) + Cross(Normalize(axis), a.w) * pstd::sin(thetaR));
+    lb.cosThetaO = pstd::cos(thetaO);
+    return lb;
+}
+
+// Measure of the directions a group emits towards, weighted by the cosine falloff beyond the cone
+static float OrientationMeasure(const LightBounds& lb) {
+    float thetaO = pstd::acos(pstd::clamp(lb.cosThetaO, -1.0f, 1.0f));
+    float thetaE = pstd::acos(pstd::clamp(lb.cosThetaE, -1.0f, 1.0f));
+    float thetaW = pstd::min(thetaO + thetaE, Pi);
+    float sinThetaO = SafeSqrt(1.0f - pstd::sqr(lb.cosThetaO));
+    return Pi2 * (1.0f - lb.cosThetaO) +
+           Pi / 2 *
+               (2 * thetaW * sinThetaO - pstd::cos(thetaO - 2 * thetaW) -
+                2 * thetaO * sinThetaO + lb.cosThetaO);
+}
+
+BVHLightSampler::BVHLightSampler(const pstd::vector<Light>& lights) : lights(lights) {
+    pstd::vector<float> lightPower;
+    for (auto&& light : lights)
+        lightPower.push_back(light.Power().y());
+    if (lights.size())
+        powerDistr = Distribution1D(&lightPower[0], (int)lightPower.size());
+
+    trails.resize(lights.size());
+    pstd::vector<pstd::pair<int, LightBounds>> items;
+    float totalPhi = 0.0f;
+    int nEmitting = 0;
+    for (int i = 0; i < (int)lights.size(); i++) {
+        if (lights[i].Is<DirectionalLight>() || lights[i].Is<EnvironmentLight>()) {
+            infiniteLights.push_back(i);
+            continue;
+        }
+        items.push_back({i, LightBounds(lights[i])});
+        if (items.back().second.phi > 0.0f) {
+            totalPhi += items.back().second.phi;
+            nEmitting++;
+        }
+    }
+    // Power() evaluates emission at a single point, so a light that is black there may still emit
+    // elsewhere; a floor keeps every light in the tree and sampleable
+    float minPhi = nEmitting ? 0.01f * totalPhi / nEmitting : 1.0f;
+    for (auto& item : items)
+        item.second.phi = pstd::max(item.second.phi, minPhi);
+    if (items.size())
+        Build(items, 0, (int)items.size(), 0, 0);
+    if (infiniteLights.size())
+        pInfinite = float(infiniteLights.size()) / (infiniteLights.size() + (nodes.size() ? 1 : 0));
+}
+
+int BVHLightSampler::Build(pstd::vector<pstd::pair<int, LightBounds>>& items, int begin, int end,
+                           uint64_t trail, int depth) {
+    int index = (int)nodes.size();
+    nodes.push_back({});
+    if (end - begin == 1) {
+        nodes[index].lb = items[begin].second;
+        nodes[index].childOrLight = items[begin].first;
+        nodes[index].isLeaf = true;
+        trails[items[begin].first] = trail;
+        return index;
+    }
+
+    AABB bounds, centroidBounds;
+    for (int i = begin; i < end; i++) {
+        bounds.Extend(items[i].second.bounds);
+        centroidBounds.Extend(items[i].second.bounds.Centroid());
+    }
+
+    // Surface area and orientation heuristic over buckets of light centroids
+    constexpr int nBuckets = 12;
+    float minCost = FloatMax;
+    int bestAxis = -1, splitBucket = -1;
+    for (int axis = 0; axis < 3; axis++) {
+        if (centroidBounds.upper[axis] <= centroidBounds.lower[axis])
+            continue;
+        LightBounds buckets[nBuckets];
+        for (int i = begin; i < end; i++) {
+            int b = nBuckets * centroidBounds.Offset(items[i].second.bounds.Centroid(axis), axis);
+            b = pstd::min(b, nBuckets - 1);
+            buckets[b] = Union(buckets[b], items[i].second);
+        }
+
+        auto Cost = [&](const LightBounds& lb) {
+            if (lb.phi == 0.0f)
+                return 0.0f;
+            float kr = bounds.Diagonal()[bounds.MaxDim()] / bounds.Diagonal()[axis];
+            return lb.phi * OrientationMeasure(lb) * kr * lb.bounds.SurfaceArea();
+        };
+        for (int i = 0; i < nBuckets - 1; i++) {
+            LightBounds below, above;
+            for (int b = 0; b <= i; b++)
+                below = Union(below, buckets[b]);
+            for (int b = i + 1; b < nBuckets; b++)
+                above = Union(above, buckets[b]);
+            float cost = Cost(below) + Cost(above);
+            if (cost > 0.0f && cost < minCost) {
+                minCost = cost;
+                bestAxis = axis;
+                splitBucket = i;
+            }
+        }
+    }
+
+    int mid = begin;
+    if (bestAxis == -1) {
+        mid = (begin + end) / 2;
+    } else {
+        for (int i = begin; i < end; i++) {
+            float centroid = items[i].second.bounds.Centroid(bestAxis);
+            int b = nBuckets * centroidBounds.Offset(centroid, bestAxis);
+            if (pstd::min(b, nBuckets - 1) <= splitBucket)
+                pstd::swap(items[i], items[mid++]);
+        }
+        if (mid == begin || mid == end)
+            mid = (begin + end) / 2;
+    }
+
+    // Lights deeper than the bits of a trail are unreachable, which only happens with degenerate
+    // distributions of more than 2^64 lights
+    CHECK_LT(depth, 64);
+    Build(items, begin, mid, trail, depth + 1);
+    int second = Build(items, mid, end, trail | (uint64_t(1) << depth), depth + 1);
+    nodes[index].childOrLight = second;
+    nodes[index].lb = Union(nodes[index + 1].lb, nodes[second].lb);
+    return index;
+}
+
+SampledLight BVHLightSampler::SampleLight(vec3 p, vec3 n, float ul) const {
+    if (ul < pInfinite) {
+        int index = pstd::min(int(ul / pInfinite * infiniteLights.size()),
+                              (int)infiniteLights.size() - 1);
+        return {&lights[infiniteLights[index]], pInfinite / infiniteLights.size()};
+    }
+    if (nodes.size() == 0)
+        return {};
+
+    float u = pstd::min((ul - pInfinite) / (1.0f - pInfinite), OneMinusEpsilon);
+    float pmf = 1.0f - pInfinite;
+    for (int index = 0;;) {
+        const Node& node = nodes[index];
+        if (node.isLeaf) {
+            if (index > 0 || node.lb.Importance(p, n) > 0.0f)
+                return {&lights[node.childOrLight], pmf};
+            return {};
+        }
+
+        float importance0 = nodes[index + 1].lb.Importance(p, n);
+        float importance1 = nodes[node.childOrLight].lb.Importance(p, n);
+        if (importance0 == 0.0f && importance1 == 0.0f)
+            return {};
+        float p0 = importance0 / (importance0 + importance1);
+        if (u < p0) {
+            index = index + 1;
+            u = pstd::min(u / p0, OneMinusEpsilon);
+            pmf *= p0;
+        } else {
+            index = node.childOrLight;
+            u = pstd::min((u - p0) / (1.0f - p0), OneMinusEpsilon);
+            pmf *= 1.0f - p0;
+        }
+    }
+}
+SampledLight BVHLightSampler::SampleLight(float ul) const {
+    SampledLight sl;
+    sl.light = &lights[powerDistr.SampleDiscreteAlias(ul, sl.pdf)];
     return sl;
 }
+float BVHLightSampler::Pdf(vec3 p, vec3 n, int index) const {
+    if (lights[index].Is<DirectionalLight>() || lights[index].Is<EnvironmentLight>())
+        return pInfinite / infiniteLights.size();
+    if (nodes.size() == 0)
+        return 0.0f;
+
+    // Follows the trail to the light's leaf, which is reached with the product of the choices
+    float pmf = 1.0f - pInfinite;
+    uint64_t trail = trails[index];
+    int nodeIndex = 0;
+    for (; !nodes[nodeIndex].isLeaf; trail >>= 1) {
+        const Node& node = nodes[nodeIndex];
+        float importance0 = nodes[nodeIndex + 1].lb.Importance(p, n);
+        float importance1 = nodes[node.childOrLight].lb.Importance(p, n);
+        if (importance0 == 0.0f && importance1 == 0.0f)
+            return 0.0f;
+        float p0 = importance0 / (importance0 + importance1);
+        pmf *= trail & 1 ? 1.0f - p0 : p0;
+        nodeIndex = trail & 1 ? node.childOrLight : nodeIndex + 1;
+    }
+    const Node& leaf = nodes[nodeIndex];
+    if (leaf.childOrLight != index)
+        return 0.0f;
+    return nodeIndex == 0 && leaf.lb.Importance(p, n) == 0.0f ? 0.0f : pmf;
+}
 
 UniformLightSampler UniformLightSampler::Create(const Parameters&,
                                                 const pstd::vector<Light>& lights) {
@@ -40,12 +342,16 @@ UniformLightSampler UniformLightSampler::Create(const Parameters&,
 PowerLightSampler PowerLightSampler::Create(const Parameters&, const pstd::vector<Light>& lights) {
     return PowerLightSampler(lights);
 }
+BVHLightSampler BVHLightSampler::Create(const Parameters&, const pstd::vector<Light>& lights) {
+    return BVHLightSampler(lights);
+}
 
 LightSampler CreateLightSampler(const Parameters& params, const pstd::vector<Light>& lights) {
     pstd::string type = params.GetString("type", "Power");
     SWITCH(type) {
         CASE("Uniform") return UniformLightSampler(UniformLightSampler::Create(params, lights));
         CASE("Power") return PowerLightSampler(PowerLightSampler::Create(params, lights));
+        CASE("BVH") return BVHLightSampler(BVHLightSampler::Create(params, lights));
         DEFAULT {
             LOG_WARNING("[LightSampler][Create]Unknown type \"&\"", type);
             return UniformLightSampler(UniformLightSampler::Create(params, lights));
@@ -2,10 +2,12 @@
 #define PINE_CORE_LIGHTSAMPLER
 
 #include <core/light.h>
+#include <core/geometry.h>
 #include <util/taggedvariant.h>
 #include <util/distribution.h>
 
 #include <pstd/vector.h>
+#include <pstd/tuple.h>
 
 namespace pine {
 
@@ -21,6 +23,7 @@ struct UniformLightSampler {
 
     SampledLight SampleLight(vec3 p, vec3 n, float ul) const;
     SampledLight SampleLight(float ul) const;
+    float Pdf(vec3 p, vec3 n, int index) const;
 
     pstd::vector<Light> lights;
 };
@@ -31,12 +34,64 @@ struct PowerLightSampler {
 
     SampledLight SampleLight(vec3 p, vec3 n, float ul) const;
     SampledLight SampleLight(float ul) const;
+    float Pdf(vec3 p, vec3 n, int index) const;
 
     pstd::vector<Light> lights;
     Distribution1D powerDistr;
 };
 
-struct LightSampler : TaggedVariant<UniformLightSampler, PowerLightSampler> {
+// Position, power and cone of emitted directions of one light or a group of lights; the cone has
+// axis `w`, half-angle acos(cosThetaO), and each direction emits over a further acos(cosThetaE)
+struct LightBounds {
+    LightBounds() = default;
+    LightBounds(const Light& light);
+
+    // Conservative estimate of the contribution to a receiver at `p` with normal `n`, where a zero
+    // `n` means the receiver is not a surface
+    float Importance(vec3 p, vec3 n) const;
+    friend LightBounds Union(const LightBounds& a, const LightBounds& b);
+
+    AABB bounds;
+    vec3 w = vec3(0, 0, 1);
+    float phi = 0.0f;
+    float cosThetaO = 1.0f;
+    float cosThetaE = 1.0f;
+    bool twoSided = false;
+};
+
+// Binary tree over the lights with finite position, traversed by choosing each child in proportion
+// to the importance of its bounds at the receiver; lights at infinity are chosen uniformly with a
+// fixed probability instead (Conty Estevez and Kulla 2018)
+struct BVHLightSampler {
+    static BVHLightSampler Create(const Parameters& params, const pstd::vector<Light>& lights);
+    BVHLightSampler(const pstd::vector<Light>& lights);
+
+    SampledLight SampleLight(vec3 p, vec3 n, float ul) const;
+    SampledLight SampleLight(float ul) const;
+    float Pdf(vec3 p, vec3 n, int index) const;
+
+    struct Node {
+        LightBounds lb;
+        // Index of the light for a leaf, of the second child otherwise as the first one follows
+        int childOrLight = 0;
+        bool isLeaf = false;
+    };
+
+    pstd::vector<Light> lights;
+    pstd::vector<int> infiniteLights;
+    // Probability of choosing among `infiniteLights` instead of traversing `nodes`
+    float pInfinite = 0.0f;
+    pstd::vector<Node> nodes;
+    // Branches taken from the root to the leaf of each light, one bit per level
+    pstd::vector<uint64_t> trails;
+    Distribution1D powerDistr;
+
+  private:
+    int Build(pstd::vector<pstd::pair<int, LightBounds>>& items, int begin, int end,
+              uint64_t trail, int depth);
+};
+
+struct LightSampler : TaggedVariant<UniformLightSampler, PowerLightSampler, BVHLightSampler> {
     using TaggedVariant::TaggedVariant;
 
     SampledLight SampleLight(vec3 p, vec3 n, float ul) const {
@@ -45,6 +100,11 @@ struct LightSampler : TaggedVariant<UniformLightSampler, PowerLightSampler> {
     SampledLight SampleLight(float ul) const {
         return Dispatch([&](auto&& x) { return x.SampleLight(ul); });
     }
+    // Probability of SampleLight(p, n, ul) choosing the `index`-th light, used by MIS when a light
+    // is reached by scattering instead
+    float Pdf(vec3 p, vec3 n, int index) const {
+        return Dispatch([&](auto&& x) { return x.Pdf(p, n, index); });
+    }
 };
 
 LightSampler CreateLightSampler(const Parameters& params, const pstd::vector<Light>& lights);
@@ -94,38 +94,62 @@ inline void GrayCodeSample(const uint32_t* C0, const uint32_t* C1, uint32_t n, v
     }
 }
 
+// Generator matrices of the (0,2)-sequence; the first one is also the van der Corput sequence
+inline constexpr uint32_t CSobol[2][32] = {
+    {0x80000000, 0x40000000, 0x20000000, 0x10000000, 0x8000000, 0x4000000, 0x2000000, 0x1000000,
+     0x800000,   0x400000,   0x200000,   0x100000,   0x80000,   0x40000,   0x20000,   0x10000,
+     0x8000,     0x4000,     0x2000,     0x1000,     0x800,     0x400,     0x200,     0x100,
+     0x80,       0x40,       0x20,       0x10,       0x8,       0x4,       0x2,       0x1},
+    {0x80000000, 0xc0000000, 0xa0000000, 0xf0000000, 0x88000000, 0xcc000000, 0xaa000000,
+     0xff000000, 0x80800000, 0xc0c00000, 0xa0a00000, 0xf0f00000, 0x88880000, 0xcccc0000,
+     0xaaaa0000, 0xffff0000, 0x80008000, 0xc000c000, 0xa000a000, 0xf000f000, 0x88008800,
+     0xcc00cc00, 0xaa00aa00, 0xff00ff00, 0x80808080, 0xc0c0c0c0, 0xa0a0a0a0, 0xf0f0f0f0,
+     0x88888888, 0xcccccccc, 0xaaaaaaaa, 0xffffffff}};
+
 inline void VanDerCorput(int nPixelSamples, float* samples, RNG& rng) {
     uint32_t scramble = rng.Uniform32u();
-    const uint32_t CVanDerCorput[32] = {
-        // clang-format off
-        0x80000000, 0x40000000, 0x20000000, 0x10000000, 0x8000000, 0x4000000,
-        0x2000000,  0x1000000,  0x800000,   0x400000,   0x200000,  0x100000,
-        0x80000,    0x40000,    0x20000,    0x10000,    0x8000,    0x4000,
-        0x2000,     0x1000,     0x800,      0x400,      0x200,     0x100,
-        0x80,       0x40,       0x20,       0x10,       0x8,       0x4,
-        0x2,        0x1
-        // clang-format on
-    };
-    GrayCodeSample(CVanDerCorput, nPixelSamples, scramble, samples);
+    GrayCodeSample(CSobol[0], nPixelSamples, scramble, samples);
     Shuffle(samples, nPixelSamples, 1, rng);
 }
 
 inline void Sobol2D(int nPixelSamples, vec2* samples, RNG& rng) {
     vec2u32 scramble = {rng.Uniform32u(), rng.Uniform32u()};
-    const uint32_t CSobol[2][32] = {
-        {0x80000000, 0x40000000, 0x20000000, 0x10000000, 0x8000000, 0x4000000, 0x2000000, 0x1000000,
-         0x800000,   0x400000,   0x200000,   0x100000,   0x80000,   0x40000,   0x20000,   0x10000,
-         0x8000,     0x4000,     0x2000,     0x1000,     0x800,     0x400,     0x200,     0x100,
-         0x80,       0x40,       0x20,       0x10,       0x8,       0x4,       0x2,       0x1},
-        {0x80000000, 0xc0000000, 0xa0000000, 0xf0000000, 0x88000000, 0xcc000000, 0xaa000000,
-         0xff000000, 0x80800000, 0xc0c00000, 0xa0a00000, 0xf0f00000, 0x88880000, 0xcccc0000,
-         0xaaaa0000, 0xffff0000, 0x80008000, 0xc000c000, 0xa000a000, 0xf000f000, 0x88008800,
-         0xcc00cc00, 0xaa00aa00, 0xff00ff00, 0x80808080, 0xc0c0c0c0, 0xa0a0a0a0, 0xf0f0f0f0,
-         0x88888888, 0xcccccccc, 0xaaaaaaaa, 0xffffffff}};
     GrayCodeSample(CSobol[0], CSobol[1], nPixelSamples, scramble, samples);
     Shuffle(samples, nPixelSamples, 1, rng);
 }
 
+// Element `i` of the pseudo-random permutation of [0, l) selected by `p` (Kensler 2013), lets
+// a shuffled sequence be indexed without generating all of it
+inline uint32_t PermutationElement(uint32_t i, uint32_t l, uint32_t p) {
+    uint32_t w = l - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do {
+        i ^= p;
+        i *= 0xe170893d;
+        i ^= p >> 16;
+        i ^= (i & w) >> 4;
+        i ^= p >> 8;
+        i *= 0x0929eb3f;
+        i ^= p >> 23;
+        i ^= (i & w) >> 1;
+        i *= 1 | p >> 27;
+        i *= 0x6935fa69;
+        i ^= (i & w) >> 11;
+        i *= 0x74dcb303;
+        i ^= (i & w) >> 2;
+        i *= 0x9e501cc3;
+        i ^= (i & w) >> 2;
+        i *= 0xc860a3df;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= l);
+    return (i + p) % l;
+}
+
 template <typename F>
 inline float SobolSample(int64_t a, int dimension, F&& randomizer) {
     uint32_t v = 0;
@@ -38,6 +38,17 @@ struct LayeredMaterial {
     pstd::optional<BSDFSample> Sample(const MaterialEvalCtx& c) const;
     Spectrum F(const MaterialEvalCtx& c) const;
     float PDF(const MaterialEvalCtx& c) const;
+    // Reflectance of the base layer, which coatings above it only tint
+    Spectrum Albedo(const MaterialEvalCtx& c) const {
+        return bsdfs.size() ? bsdfs.back().Albedo(c) : vec3(0.0f);
+    }
+    // True if no layer has a non-specular lobe
+    bool IsSpecular(const MaterialEvalCtx& c) const {
+        for (auto&& bsdf : bsdfs)
+            if (!bsdf.IsSpecular(c))
+                return false;
+        return true;
+    }
     Spectrum Le(const MaterialEvalCtx&) const {
         return {};
     }
@@ -57,6 +68,12 @@ struct EmissiveMaterial {
     float PDF(const MaterialEvalCtx&) const {
         return {};
     }
+    Spectrum Albedo(const MaterialEvalCtx&) const {
+        return Spectrum(1.0f);
+    }
+    bool IsSpecular(const MaterialEvalCtx&) const {
+        return false;
+    }
     Spectrum Le(const MaterialEvalCtx& c) const {
         if (CosTheta(c.wi) > 0.0f)
             return color.EvalVec3(c);
@@ -96,6 +113,14 @@ struct Material : public TaggedVariant<LayeredMaterial, EmissiveMaterial> {
         return Dispatch([&](auto&& x) { return x.PDF(c); });
     }
 
+    // Used for the albedo AOV, not for shading
+    Spectrum Albedo(const MaterialEvalCtx& c) const {
+        return Dispatch([&](auto&& x) { return x.Albedo(c); });
+    }
+    bool IsSpecular(const MaterialEvalCtx& c) const {
+        return Dispatch([&](auto&& x) { return x.IsSpecular(c); });
+    }
+
     Spectrum Le(const MaterialEvalCtx& c) const {
         SampledProfiler _(ProfilePhase::MaterialSample);
 
@@ -16,6 +16,11 @@ static constexpr float OneMinusEpsilon = 0x1.fffffep-1;
 static constexpr float FloatMax = pstd::numeric_limits<float>::max();
 static constexpr float Infinity = pstd::numeric_limits<float>::infinity();
 
+// For arguments that are only negative through rounding, such as 1 - cos^2
+inline float SafeSqrt(float x) {
+    return pstd::sqrt(pstd::max(x, 0.0f));
+}
+
 inline uint32_t ReverseBits32(uint32_t x) {
     x = (x & 0x55555555) << 1 | (x & 0xaaaaaaaa) >> 1;
     x = (x & 0x33333333) << 2 | (x & 0xcccccccc) >> 2;
@@ -63,6 +68,35 @@ inline float ErfInv(float x) {
     return p * x;
 }
 
+// Branch-free approximations, accurate to ~1e-6 relative error; written so that loops
+// over them auto-vectorize
+inline float FastLog2(float x) {
+    uint32_t bits = pstd::bitcast<uint32_t>(x);
+    int e = int(bits >> 23) - 127;
+    float m = pstd::bitcast<float>((bits & 0x007fffffu) | 0x3f800000u);
+    bool large = m > pstd::Sqrt2;
+    m = large ? m * 0.5f : m;
+    e += large ? 1 : 0;
+
+    float s = (m - 1.0f) / (m + 1.0f);
+    float s2 = s * s;
+    float lnm = 2.0f * s * (1.0f + s2 * (1.0f / 3.0f + s2 * (1.0f / 5.0f + s2 * (1.0f / 7.0f))));
+    return e + lnm * pstd::Log2E;
+}
+
+inline float FastExp2(float x) {
+    x = pstd::clamp(x, -126.0f, 126.0f);
+    int xi = int(x + 126.5f) - 126;
+    float f = (x - xi) * pstd::Ln2;
+    float p = 1.0f + f * (1.0f + f * (1.0f / 2.0f + f * (1.0f / 6.0f +
+                      f * (1.0f / 24.0f + f * (1.0f / 120.0f + f * (1.0f / 720.0f))))));
+    return p * pstd::bitcast<float>(uint32_t(xi + 127) << 23);
+}
+
+inline float FastPow(float x, float p) {
+    return x > 0.0f ? FastExp2(p * FastLog2(x)) : 0.0f;
+}
+
 template <typename Predicate>
 int FindInterval(int size, const Predicate& pred) {
     if (size < 2)
@@ -3,6 +3,7 @@
 #include <core/sampling.h>
 #include <util/parameters.h>
 #include <util/fileio.h>
+#include <util/assetcache.h>
 
 namespace pine {
 
@@ -23,7 +24,7 @@ float PhaseFunction::Sample(vec3 wi, vec3& wo, vec2 u2) const {
         cosTheta = -(1.0f + g * g - sqrTerm * sqrTerm) / (2.0f * g);
     }
 
-    float sinTheta = pstd::sqrt(1.0f - cosTheta * cosTheta);
+    float sinTheta = SafeSqrt(1.0f - cosTheta * cosTheta);
     float phi = 2 * Pi * u2[1];
     mat3 m = CoordinateSystem(wi);
     wo = m * vec3(sinTheta * pstd::cos(phi), sinTheta * pstd::sin(phi), cosTheta);
@@ -156,11 +157,12 @@ float GridMedium::Density(vec3 p) const {
 float GridMedium::D(vec3i p) const {
     if (!Inside(p, vec3i(0), size))
         return 0.0f;
-    return density[p.x + p.y * size.x + p.z * size.y * size.x];
+    return (*density)[p.x + p.y * size.x + p.z * size.y * size.x];
 }
 
 GridMedium::GridMedium(Spectrum sigma_a, Spectrum sigma_s, PhaseFunction phaseFunction, vec3i size,
-                       vec3 position, float scale, pstd::vector<float> density, bool interpolate,
+                       vec3 position, float scale,
+                       pstd::shared_ptr<pstd::vector<float>> density, bool interpolate,
                        SamplingMethod method, float rayMarchingStepSize)
     : sigma_a(sigma_a),
       sigma_s(sigma_s),
@@ -188,9 +190,18 @@ HomogeneousMedium HomogeneousMedium::Create(const Parameters& params) {
 }
 
 GridMedium GridMedium::Create(const Parameters& params) {
-    auto [density, size] = LoadVolume(params.GetString("file"));
+    // Keyed by the path, the file size and the grid size read from the header, so a cached
+    // volume is found without reading the whole file
+    pstd::string filename = params.GetString("file");
+    pstd::string path = ResolveFilePath(filename);
+    ScopedFile file(filename, pstd::ios::in | pstd::ios::binary);
+    size_t fileSize = file.Size();
+    vec3i size = file.Read<vec3i>();
+    auto density = AssetCache::FindOrCreate<pstd::vector<float>>(
+        Hash(HashBuffer(path.data(), path.size()), fileSize, size),
+        [&]() { return LoadVolume(filename).first; });
     LOG("[GridMedium]Grid size: &", size);
-    LOG("[GridMedium]Memory usage: & MB", sizeof(density[0]) * density.size() / 1000000.0);
+    LOG("[GridMedium]Memory usage: & MB", sizeof(float) * density->size() / 1000000.0);
     SamplingMethod method = SamplingMethod::DeltaTracking;
     pstd::string samplingMethod = params.GetString("samplingMethod", "deltaTracking");
     SWITCH(samplingMethod) {
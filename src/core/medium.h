@@ -41,7 +41,8 @@ struct GridMedium {
 
     static GridMedium Create(const Parameters& params);
     GridMedium(Spectrum sigma_a, Spectrum sigma_s, PhaseFunction phaseFunction, vec3i size,
-               vec3 position, float scale, pstd::vector<float> density, bool interpolate,
+               vec3 position, float scale, pstd::shared_ptr<pstd::vector<float>> density,
+               bool interpolate,
                SamplingMethod method, float rayMarchingStepSize);
 
     Spectrum Tr(const Ray& ray, Sampler& sampler) const;
@@ -57,7 +58,7 @@ struct GridMedium {
     float invMaxDensity;
     mat4 m2w;
     mat4 w2m;
-    pstd::vector<float> density;
+    pstd::shared_ptr<pstd::vector<float>> density;
     bool interpolate;
     SamplingMethod method;
     float rayMarchingStepSize;
@@ -68,10 +69,12 @@ struct Medium : TaggedVariant<HomogeneousMedium, GridMedium> {
 
     Spectrum Tr(const Ray& ray, Sampler& sampler) const {
         SampledProfiler _(ProfilePhase::MediumTr);
+        Telemetry::Count(TelemetryCounter::MediumRays);
         return Dispatch([&](auto&& x) { return x.Tr(ray, sampler); });
     }
     Spectrum Sample(const Ray& ray, Interaction& mi, Sampler& sampler) const {
         SampledProfiler _(ProfilePhase::MediumSample);
+        Telemetry::Count(TelemetryCounter::MediumRays);
         return Dispatch([&](auto&& x) { return x.Sample(ray, mi, sampler); });
     }
 };
@@ -1,5 +1,6 @@
 #include <core/node.h>
 #include <util/fileio.h>
+#include <util/assetcache.h>
 #include <util/parameters.h>
 
 namespace pine {
@@ -20,14 +21,16 @@ vec3 NodeInput::EvalVec3(const NodeEvalCtx& c) const {
 nodes::Texture::Texture(NodeInput texcoord, pstd::string_view filename) : texcoord(texcoord) {
     LOG("[Texture]Loading \"&\"", filename);
     pstd::unique_ptr<vec3u8[]> ptr(ReadLDRImage(filename, size));
-    texels.assign(ptr.get(), ptr.get() + Area(size));
+    texels = AssetCache::FindOrCreate<pstd::vector<vec3u8>>(
+        Hash(size, HashBuffer(ptr.get(), sizeof(vec3u8) * Area(size))),
+        [&]() { return pstd::vector<vec3u8>(ptr.get(), ptr.get() + Area(size)); });
 }
 
 vec3 nodes::Texture::EvalVec3(const NodeEvalCtx& c) const {
-    if (size == vec2i(0) || texels.size() == 0)
+    if (size == vec2i(0) || !texels || texels->size() == 0)
         return vec3(0.0f, 0.0f, 1.0f);
     vec2i co = size * pine::Fract(texcoord.EvalVec3(c));
-    return pine::Pow(texels[co.x + co.y * size.x] / 255.0f, 2.2f);
+    return pine::Pow((*texels)[co.x + co.y * size.x] / 255.0f, 2.2f);
 }
 
 Node* CreateNode(const Parameters& params) {
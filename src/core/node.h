@@ -394,7 +394,7 @@ struct Texture : Node {
 
     NodeInput texcoord;
     vec2i size;
-    pstd::vector<vec3u8> texels;
+    pstd::shared_ptr<pstd::vector<vec3u8>> texels;
 };
 
 }  // namespace nodes
@@ -98,32 +98,40 @@ const uint16_t* HaltonSampler::PermutationForDimension(int dim) const {
 ZeroTwoSequenceSampler::ZeroTwoSequenceSampler(int spp, int nSampledDimensions)
     : nSampledDimensions(nSampledDimensions) {
     samplesPerPixel = pstd::roundup2(spp);
-    for (int i = 0; i < nSampledDimensions; i++) {
-        samples1D.push_back(pstd::vector<float>(samplesPerPixel));
-        samples2D.push_back(pstd::vector<vec2>(samplesPerPixel));
-    }
 }
-void ZeroTwoSequenceSampler::StartPixel(vec2i, int sampleIndex) {
-    currentSampleIndex = sampleIndex;
+void ZeroTwoSequenceSampler::StartPixel(vec2i p, int sampleIndex) {
+    // Every (pixel, round) has its own scrambles and sample order, and samples are computed
+    // from their index, so passes can start anywhere without regenerating a whole round
+    pixel = p;
+    round = sampleIndex / samplesPerPixel;
+    currentSampleIndex = sampleIndex % samplesPerPixel;
     current1DDimension = current2DDimension = 0;
-    if (sampleIndex == 0) {
-        for (auto& s : samples1D)
-            VanDerCorput(samplesPerPixel, &s[0], rng);
-        for (auto& s : samples2D)
-            Sobol2D(samplesPerPixel, &s[0], rng);
-    }
+    seed = Hash(pixel, round);
+    rng = RNG(Hash(pixel, sampleIndex));
+}
+void ZeroTwoSequenceSampler::StartNextSample() {
+    // Only progressive passes run past the end of a round
+    if (currentSampleIndex + 1 == samplesPerPixel)
+        return StartPixel(pixel, (round + 1) * samplesPerPixel);
+    currentSampleIndex++;
+    current1DDimension = current2DDimension = 0;
+    rng = RNG(Hash(pixel, round * samplesPerPixel + currentSampleIndex));
 }
 float ZeroTwoSequenceSampler::Get1D() {
-    if (current1DDimension < (int)samples1D.size())
-        return samples1D[current1DDimension++][currentSampleIndex];
-    else
+    if (current1DDimension >= nSampledDimensions)
         return rng.Uniformf();
+    uint64_t h = Hash(seed, 1, current1DDimension++);
+    uint32_t index = PermutationElement(currentSampleIndex, samplesPerPixel, h >> 32);
+    return SampleGeneratorMatrix(CSobol[0], index, uint32_t(h));
 }
 vec2 ZeroTwoSequenceSampler::Get2D() {
-    if (current2DDimension < (int)samples2D.size())
-        return samples2D[current2DDimension++][currentSampleIndex];
-    else
+    if (current2DDimension >= nSampledDimensions)
         return rng.Uniform2f();
+    uint64_t h = Hash(seed, 2, current2DDimension++);
+    uint32_t index = PermutationElement(currentSampleIndex, samplesPerPixel, h >> 32);
+    uint64_t scramble = Hash64u(h);
+    return {SampleGeneratorMatrix(CSobol[0], index, uint32_t(scramble)),
+            SampleGeneratorMatrix(CSobol[1], index, scramble >> 32)};
 }
 
 SobolSampler::SobolSampler(int spp, vec2i filmSize, RandomizeStrategy randomizeStrategy)
@@ -13,15 +13,22 @@ namespace pine {
 struct UniformSampler {
     static UniformSampler Create(const Parameters& params);
     UniformSampler(int samplesPerPixel, int seed = 0)
-        : samplesPerPixel(samplesPerPixel), rng(seed) {
+        : samplesPerPixel(samplesPerPixel), seed(seed), rng(seed) {
     }
 
     int SamplesPerPixel() const {
         return samplesPerPixel;
     }
-    void StartPixel(const vec2i&, int) {
+    // Seeded by (pixel, sample index), so a sample does not depend on which thread, pass, shard
+    // or resumed run computes it
+    void StartPixel(vec2i p, int index) {
+        pixel = p;
+        sampleIndex = index;
+        rng = RNG(Hash(pixel, sampleIndex, seed));
     }
     void StartNextSample() {
+        sampleIndex++;
+        rng = RNG(Hash(pixel, sampleIndex, seed));
     }
     float Get1D() {
         return rng.Uniformf();
@@ -31,7 +38,10 @@ struct UniformSampler {
     }
 
     int samplesPerPixel;
+    int seed;
     RNG rng;
+    vec2i pixel;
+    int sampleIndex = 0;
 };
 
 struct StratifiedSampler {
@@ -48,10 +58,12 @@ struct StratifiedSampler {
         pixel = p;
         sampleIndex = index;
         dimension = 0;
+        rng = RNG(Hash(pixel, sampleIndex));
     }
     void StartNextSample() {
         sampleIndex++;
         dimension = 0;
+        rng = RNG(Hash(pixel, sampleIndex));
     }
     float Get1D() {
         int stratum = (sampleIndex + Hash(pixel, dimension)) % samplesPerPixel;
@@ -121,21 +133,18 @@ struct ZeroTwoSequenceSampler {
         return samplesPerPixel;
     }
     void StartPixel(vec2i p, int sampleIndex);
-    void StartNextSample() {
-        currentSampleIndex++;
-        current1DDimension = 0;
-        current2DDimension = 0;
-    }
+    void StartNextSample();
     float Get1D();
     vec2 Get2D();
 
     int samplesPerPixel;
     int nSampledDimensions;
 
+    vec2i pixel;
+    int round = 0;
     int currentSampleIndex = 0;
     int current1DDimension = 0, current2DDimension = 0;
-    pstd::vector<pstd::vector<float>> samples1D;
-    pstd::vector<pstd::vector<vec2>> samples2D;
+    uint64_t seed = 0;
     RNG rng;
 };
 
@@ -166,6 +175,7 @@ struct SobolSampler {
 };
 
 struct MltSampler {
+    MltSampler() = default;
     MltSampler(float sigma, float largeStepProbability, int streamCount, int seed)
         : rng(seed),
           sigma(sigma),
@@ -215,6 +225,9 @@ struct MltSampler {
         --sampleIndex;
     }
 
+    PSTD_ARCHIVE(rng, sigma, largeStepProbability, X, sampleIndex, streamIndex, streamCount,
+                 dimension, largeStep, lastLargeStepIndex)
+
   private:
     void EnsureReady(int dim);
     int GetNextIndex() {
@@ -231,13 +244,15 @@ struct MltSampler {
             lastModificationIndex = modifyBackup;
         }
 
+        PSTD_ARCHIVE(value, valueBackup, lastModificationIndex, modifyBackup)
+
         float value = 0, valueBackup = 0;
         int64_t lastModificationIndex = 0;
         int64_t modifyBackup = 0;
     };
 
     RNG rng;
-    const float sigma, largeStepProbability;
+    float sigma = 0.0f, largeStepProbability = 0.0f;
     pstd::vector<PrimarySample> X;
     int64_t sampleIndex = 0;
     int64_t streamIndex = 0, streamCount = 0;
@@ -132,7 +132,7 @@ struct TrowbridgeReitzDistribution {
 
         vec2 p = SampleDiskPolar(u);
 
-        float h = pstd::sqrt(1.0f - pstd::sqr(p.x));
+        float h = SafeSqrt(1.0f - pstd::sqr(p.x));
         p.y = pstd::lerp((1.0f + wh.z) / 2, h, p.y);
 
         float pz = pstd::sqrt(pstd::max(0.0f, 1.0f - LengthSquared(p)));
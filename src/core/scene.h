@@ -17,6 +17,8 @@ namespace pine {
 
 struct Scene {
     pstd::shared_ptr<Integrator> integrator;
+    // Built by the first RayIntegrator and reused by later ones while the shapes are unchanged
+    pstd::shared_ptr<Accel> accel;
 
     pstd::map<pstd::string, pstd::shared_ptr<Material>> materials;
     pstd::map<pstd::string, pstd::shared_ptr<Medium>> mediums;
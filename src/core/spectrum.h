@@ -163,6 +163,8 @@ class CoefficientSpectrum {
         return false;
     }
 
+    PSTD_ARCHIVE(c)
+
     float c[nSpectrumSamples];
 };
 
@@ -2,6 +2,7 @@
 #include <core/scene.h>
 #include <util/parameters.h>
 #include <util/profiler.h>
+#include <util/assetcache.h>
 
 #include <queue>
 
@@ -616,16 +617,22 @@ void BVH::Initialize(const Scene* scene) {
 
     for (int i = 0; i < (int)scene->shapes.size(); i++) {
         if (scene->shapes[i].Is<TriangleMesh>()) {
-            pstd::vector<BVHImpl::Primitive> primitives;
-            for (auto& t : scene->shapes[i].Be<TriangleMesh>().ToTriangles()) {
-                BVHImpl::Primitive primitive;
-                primitive.aabb = t.GetAABB();
-                primitive.index = (int)primitives.size();
-                primitives.push_back(primitive);
-            }
-            BVHImpl bvh;
-            bvh.Build(pstd::move(primitives));
-            lbvh.push_back(pstd::move(bvh));
+            auto& mesh = scene->shapes[i].Be<TriangleMesh>();
+            uint64_t key =
+                Hash(HashBuffer(mesh.vertices->data(), mesh.vertices->size() * sizeof(vec3)),
+                     HashBuffer(mesh.indices->data(), mesh.indices->size() * 4));
+            lbvh.push_back(AssetCache::FindOrCreate<BVHImpl>(key, [&]() {
+                pstd::vector<BVHImpl::Primitive> primitives;
+                for (auto& t : mesh.ToTriangles()) {
+                    BVHImpl::Primitive primitive;
+                    primitive.aabb = t.GetAABB();
+                    primitive.index = (int)primitives.size();
+                    primitives.push_back(primitive);
+                }
+                BVHImpl bvh;
+                bvh.Build(pstd::move(primitives));
+                return bvh;
+            }));
             indices.push_back(i);
         }
     }
@@ -633,7 +640,7 @@ void BVH::Initialize(const Scene* scene) {
     pstd::vector<BVHImpl::Primitive> primitives;
     for (auto& s : lbvh) {
         BVHImpl::Primitive primitive;
-        primitive.aabb = s.GetAABB();
+        primitive.aabb = s->GetAABB();
         primitive.index = (int)primitives.size();
         primitives.push_back(primitive);
     }
@@ -657,7 +664,7 @@ bool BVH::Hit(Ray ray) const {
         auto& shape = scene->shapes[indices[lbvhIndex]];
 
         if (lbvhIndex < (int)lbvh.size()) {
-            return lbvh[lbvhIndex].Hit(ray, [&](const Ray& ray, int index) {
+            return lbvh[lbvhIndex]->Hit(ray, [&](const Ray& ray, int index) {
                 return shape.Be<TriangleMesh>().GetTriangle(index).Hit(ray);
             });
         } else {
@@ -677,10 +684,11 @@ bool BVH::Intersect(Ray& ray, Interaction& it) const {
             auto& shape = scene->shapes[indices[lbvhIndex]];
 
             if (lbvhIndex < (int)lbvh.size()) {
-                return lbvh[lbvhIndex].Intersect(
+                return lbvh[lbvhIndex]->Intersect(
                     ray, it,
                     [&](Ray& ray, Interaction& it, int index) {
-                        return shape.Be<TriangleMesh>().GetTriangle(index).Intersect(ray, it);
+                        Triangle tri = shape.Be<TriangleMesh>().GetTriangle(index);
+                        return Triangle::Intersect(ray, it, tri.v0, tri.v1, tri.v2);
                     },
                     [&](Interaction&, int tIndex) { triangleIndex = tIndex; });
             } else {
@@ -78,7 +78,7 @@ class BVH : public Accel {
     bool Hit(Ray ray) const;
     bool Intersect(Ray& ray, Interaction& it) const;
 
-    pstd::vector<BVHImpl> lbvh;
+    pstd::vector<pstd::shared_ptr<BVHImpl>> lbvh;
     BVHImpl tbvh;
     pstd::vector<int> indices;
     const Scene* scene;
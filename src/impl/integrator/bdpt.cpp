@@ -145,6 +145,7 @@ int RandomWalk(const Scene *, const RayIntegrator &integrator, Ray ray, Sampler
             auto bs = it.material->Sample(mc);
             if (!bs)
                 break;
+            vertex.specular = bs->isSpecular;
             pdfFwd = bs->pdf;
             beta *= bs->f * AbsDot(bs->wo, it.n) / pdfFwd;
             pdfRev = it.material->PDF(MaterialEvalCtx(it, bs->wo, -ray.d));
@@ -317,7 +318,8 @@ BDPTIntegrator::BDPTIntegrator(const Parameters &params, Scene *scene)
 }
 
 void BDPTIntegrator::Compute(vec2i p, Sampler &sampler) {
-    vec2 pFilm = (p + sampler.Get2D()) / filmSize;
+    FilmSample fs = film->Sample(p, sampler.Get2D());
+    vec2 pFilm = fs.pFilm;
     auto cameraVertices = (Vertex *)&this->cameraVertices[threadIdx][0];
     auto lightVertices = (Vertex *)&this->lightVertices[threadIdx][0];
     int nCamera = GenerateCameraSubpath(scene, *this, sampler, maxDepth + 2, pFilm, cameraVertices);
@@ -341,7 +343,33 @@ void BDPTIntegrator::Compute(vec2i p, Sampler &sampler) {
                 film->AddSplat(pFilmNew, Lpath);
         }
     }
-    film->AddSample(pFilm, L);
+    film->AddSample(p, fs, L);
+
+    if (film->HasAOVs()) {
+        // Guides come from the first non-specular surface, seen through any specular ones; paths
+        // that escape record the tint of the specular chain, as PathIntegrator does
+        Spectrum tint(1.0f);
+        float depth = 0.0f;
+        int i = 1;
+        for (; i < nCamera && cameraVertices[i].type == VertexType::Surface; i++) {
+            const Vertex &v = cameraVertices[i];
+            depth += Distance(cameraVertices[i - 1].p(), v.p());
+            if (!v.si.material)
+                break;
+            auto mc = MaterialEvalCtx(v.si, Normalize(cameraVertices[i - 1].p() - v.p()));
+            if (v.specular) {
+                tint = v.beta * v.si.material->Albedo(mc);
+                continue;
+            }
+            Spectrum albedo = v.beta;
+            if (!v.si.material->Is<EmissiveMaterial>())
+                albedo *= v.si.material->Albedo(mc);
+            film->AddAOV(p, AOVSample{albedo.ToRGB(), v.si.material->BumpNormal(mc), depth, true});
+            break;
+        }
+        if (i == nCamera)
+            film->AddAOV(p, AOVSample{tint.ToRGB(), vec3(0.0f), 0.0f, true});
+    }
 }
 
 }  // namespace pine
\ No newline at end of file
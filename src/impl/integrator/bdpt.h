@@ -129,6 +129,9 @@ struct Vertex {
     Interaction si;
     vec3 wi;
     bool delta = false;
+    // Whether the direction leaving the vertex came from a specular lobe; unlike `delta` it
+    // does not take part in MIS
+    bool specular = false;
     float pdfFwd = 0.0f, pdfRev = 0.0f;
 };
 
@@ -3,6 +3,7 @@
 #include <impl/integrator/bdpt.h>
 #include <impl/integrator/randomwalk.h>
 #include <core/scene.h>
+#include <util/archive.h>
 
 #include <pstd/tuple.h>
 
@@ -19,7 +20,9 @@ MltIntegrator::MltIntegrator(const Parameters& params, Scene* scene) : Integrato
             integrator = pstd::make_unique<PathIntegrator>(params, scene);
         }
     }
-    nMutations = (int64_t)Area(filmSize) * params.GetInt("mutationsPerPixel", samplesPerPixel);
+    int mutationsPerPixel = params.GetInt("mutationsPerPixel", samplesPerPixel);
+    nMutations = (int64_t)Area(filmSize) * mutationsPerPixel;
+    checkpointer.key.samplesPerPixel = mutationsPerPixel;
     sigma = params.GetFloat("sigma", 0.01f);
     largeStepProbability = params.GetFloat("largeStepProbability", 0.3f);
 }
@@ -29,6 +32,22 @@ static const int lightStreamIndex = 1;
 static const int connectionStreamIndex = 2;
 static const int nSampleStreams = 3;
 
+struct MarkovChainState {
+    PSTD_ARCHIVE(rng, sampler, pFilm, L)
+
+    RNG rng;
+    MltSampler sampler;
+    vec2 pFilm;
+    Spectrum L;
+};
+
+struct MltState {
+    PSTD_ARCHIVE(I, chains)
+
+    float I = 0.0f;
+    pstd::vector<MarkovChainState> chains;
+};
+
 Spectrum MltIntegrator::L(Sampler& sampler, int depth, vec2& pFilm) {
     sampler.Be<MltSampler>().StartStream(cameraStreamIndex);
     int s, t, nStrategies;
@@ -61,84 +80,175 @@ Spectrum MltIntegrator::L(Sampler& sampler, int depth, vec2& pFilm) {
 }
 
 void MltIntegrator::Render() {
-    int64_t nMarkovChains = NumThreads() * 32;
+    Profiler _("Rendering");
+    film->DisableTiling();
+    if (shardCount > 1)
+        LOG_WARNING("[MltIntegrator][Render]Sharding is unsupported, rendering the full image");
+
+    MltState state;
+    auto checkpoint = checkpointer.Load();
+    if (checkpoint)
+        state = Unarchive<MltState>(checkpoint->state);
+    // Chains are independent of the threads running them, so a render resumed on a machine with
+    // another core count keeps the chain count of its checkpoint
+    bool resume = checkpoint && state.chains.size() && film->LoadAccumulation(checkpoint->film);
+    if (checkpoint && !resume)
+        LOG_WARNING("[MltIntegrator][Render]Checkpoint has no chain state, starting over");
+
+    int64_t nMarkovChains = resume ? (int64_t)state.chains.size() : NumThreads() * 32;
     int64_t nMutationsPerChain = pstd::max(nMutations / nMarkovChains, 1l);
     int64_t nBootstrapSamples = nMutations / 32;
 
     ProgressReporter pr("Rendering", "MarkovChains", "Mutations", nMarkovChains,
                         nMutationsPerChain);
 
-    Timer timer;
-    AtomicFloat atomicI;
-    ParallelFor(nBootstrapSamples, [&](int index) {
+    struct MarkovChain {
+        RNG rng;
+        Sampler sampler;
+        vec2 pFilm;
+        Spectrum L;
+    };
+    pstd::vector<MarkovChain> chains(nMarkovChains);
+    float I = 0.0f;
+    int64_t nChainMutations = 0;
+
+    auto L = [&](MarkovChain& chain) -> pstd::pair<vec2, Spectrum> {
         if (bdpt) {
-            for (int depth = 0; depth < bdpt->maxDepth; depth++) {
-                Sampler sampler = MltSampler(sigma, largeStepProbability, nSampleStreams,
-                                             index * bdpt->maxDepth + depth);
-                vec2 pFilm;
-                Spectrum l = MltIntegrator::L(sampler, depth, pFilm);
-                if (!l.HasInfs() && !l.HasNaNs())
-                    atomicI.Add(l.y());
-            }
+            vec2 pFilm;
+            Spectrum l =
+                MltIntegrator::L(chain.sampler, chain.rng.Uniformf() * bdpt->maxDepth, pFilm);
+            return {pFilm, l};
         } else {
-            Sampler sampler = UniformSampler(1, index);
-            vec2 pFilm = sampler.Get2D();
-            Ray ray = scene->camera.GenRay(pFilm, sampler.Get2D());
-            atomicI.Add(integrator->Li(ray, sampler).y());
+            vec2 pFilm = chain.sampler.Get2D();
+            Ray ray = scene->camera.GenRay(pFilm, chain.sampler.Get2D());
+            return {pFilm, integrator->Li(ray, chain.sampler)};
         }
-    });
-    float I = (float)atomicI / nBootstrapSamples;
-
-    ParallelFor(nMarkovChains, [&](int chainIndex) {
-        ScopedPR(pr, chainIndex, chainIndex == nMarkovChains - 1, threadIdx == 0);
-        RNG rng(chainIndex);
-        Sampler sampler =
-            MltSampler(sigma, largeStepProbability, bdpt ? nSampleStreams : 1, chainIndex);
-
-        auto L = [&]() -> pstd::pair<vec2, Spectrum> {
+    };
+
+    if (resume) {
+        nChainMutations = checkpoint->passIndex;
+        I = state.I;
+        for (int64_t i = 0; i < nMarkovChains; i++) {
+            chains[i].rng = state.chains[i].rng;
+            chains[i].sampler = state.chains[i].sampler;
+            chains[i].pFilm = state.chains[i].pFilm;
+            chains[i].L = state.chains[i].L;
+        }
+    } else {
+        AtomicFloat atomicI;
+        ParallelFor(nBootstrapSamples, [&](int index) {
             if (bdpt) {
-                vec2 pFilm;
-                Spectrum l = MltIntegrator::L(sampler, rng.Uniformf() * bdpt->maxDepth, pFilm);
-                return {pFilm, l};
+                for (int depth = 0; depth < bdpt->maxDepth; depth++) {
+                    Sampler sampler = MltSampler(sigma, largeStepProbability, nSampleStreams,
+                                                 index * bdpt->maxDepth + depth);
+                    vec2 pFilm;
+                    Spectrum l = MltIntegrator::L(sampler, depth, pFilm);
+                    if (!l.HasInfs() && !l.HasNaNs())
+                        atomicI.Add(l.y());
+                }
             } else {
+                Sampler sampler = UniformSampler(1, index);
                 vec2 pFilm = sampler.Get2D();
                 Ray ray = scene->camera.GenRay(pFilm, sampler.Get2D());
-                return {pFilm, integrator->Li(ray, sampler)};
-            }
-        };
-
-        auto [pFilmCurrent, Lcurrent] = L();
-
-        for (int m = 0; m < nMutationsPerChain; m++) {
-            sampler.StartNextSample();
-            auto [pFilmProposed, Lproposed] = L();
-            float pAccept = pstd::clamp(Lproposed.y() / Lcurrent.y(), 0.0f, 1.0f);
-            if (Lcurrent.HasInfs() || Lcurrent.HasNaNs())
-                pAccept = 1.0f;
-
-            float pdfCurrent = Lcurrent.y() / I;
-            float pdfProposed = Lproposed.y() / I;
-            Spectrum wCurrent = (1.0f - pAccept) * Lcurrent * SafeRcp(pdfCurrent);
-            Spectrum wProposed = pAccept * Lproposed * SafeRcp(pdfProposed);
-
-            if (!wCurrent.HasInfs() && !wCurrent.HasNaNs())
-                film->AddSplat(pFilmCurrent, wCurrent);
-            if (!wProposed.HasInfs() && !wProposed.HasNaNs())
-                film->AddSplat(pFilmProposed, wProposed);
-
-            if (rng.Uniformf() < pAccept) {
-                pFilmCurrent = pFilmProposed;
-                Lcurrent = Lproposed;
-                sampler.Be<MltSampler>().Accept();
-            } else {
-                sampler.Be<MltSampler>().Reject();
+                atomicI.Add(integrator->Li(ray, sampler).y());
             }
-        }
-    });
+        });
+        I = (float)atomicI / nBootstrapSamples;
+
+        ParallelFor(nMarkovChains, [&](int chainIndex) {
+            MarkovChain& chain = chains[chainIndex];
+            chain.rng = RNG(chainIndex);
+            chain.sampler =
+                MltSampler(sigma, largeStepProbability, bdpt ? nSampleStreams : 1, chainIndex);
+            auto [pFilm, l] = L(chain);
+            chain.pFilm = pFilm;
+            chain.L = l;
+        });
+    }
 
+    auto saveCheckpoint = [&]() {
+        MltState state;
+        state.I = I;
+        for (auto& chain : chains)
+            state.chains.push_back(
+                {chain.rng, chain.sampler.Be<MltSampler>(), chain.pFilm, chain.L});
+        checkpointer.SaveAsync({nChainMutations, film->SaveAccumulation(), Archive(state)});
+    };
+
+    bool progressive = budget.IsProgressive() || checkpointer.IsActive();
+    int64_t maxMutationsPerChain =
+        budget.HasTimeLimit() ? pstd::numeric_limits<int32_t>::max() : nMutationsPerChain;
+    int64_t mutationsPerPass =
+        progressive ? pstd::max((int64_t)budget.samplesPerPass * Area(filmSize) / nMarkovChains,
+                                (int64_t)1)
+                    : nMutationsPerChain;
+    ConvergenceEstimator estimator(progressive ? Area(filmSize) : 0);
     double dA = 1.0f / Area(filmSize);
-    double N = nMutations;
+    budget.Start();
+    if (progressive)
+        estimator.Rebase(*film);
+
+    while (nChainMutations < maxMutationsPerChain) {
+        int64_t nPassMutations =
+            pstd::min(mutationsPerPass, maxMutationsPerChain - nChainMutations);
+
+        ParallelFor(nMarkovChains, [&](int chainIndex) {
+            ScopedPR(pr, chainIndex, !progressive && chainIndex == nMarkovChains - 1,
+                     !progressive && threadIdx == 0);
+            MarkovChain& chain = chains[chainIndex];
+            Sampler& sampler = chain.sampler;
+
+            for (int m = 0; m < nPassMutations; m++) {
+                sampler.StartNextSample();
+                auto [pFilmProposed, Lproposed] = L(chain);
+                float pAccept = pstd::clamp(Lproposed.y() / chain.L.y(), 0.0f, 1.0f);
+                if (chain.L.HasInfs() || chain.L.HasNaNs())
+                    pAccept = 1.0f;
+
+                float pdfCurrent = chain.L.y() / I;
+                float pdfProposed = Lproposed.y() / I;
+                Spectrum wCurrent = (1.0f - pAccept) * chain.L * SafeRcp(pdfCurrent);
+                Spectrum wProposed = pAccept * Lproposed * SafeRcp(pdfProposed);
+
+                if (!wCurrent.HasInfs() && !wCurrent.HasNaNs())
+                    film->AddSplat(chain.pFilm, wCurrent);
+                if (!wProposed.HasInfs() && !wProposed.HasNaNs())
+                    film->AddSplat(pFilmProposed, wProposed);
+
+                if (chain.rng.Uniformf() < pAccept) {
+                    chain.pFilm = pFilmProposed;
+                    chain.L = Lproposed;
+                    sampler.Be<MltSampler>().Accept();
+                } else {
+                    sampler.Be<MltSampler>().Reject();
+                }
+            }
+        });
+        nChainMutations += nPassMutations;
+        if (!progressive)
+            continue;
+
+        double N = nChainMutations * nMarkovChains;
+        estimator.AddPass(*film, 1.0 / dA / (nPassMutations * nMarkovChains));
+        float error = estimator.RelativeError();
+        LOG_SAMELINE("[Rendering]Mutations[&]  Time[&.1s]  Error[&.4]", (int64_t)N,
+                     budget.ElapsedSeconds(), error);
+        if (budget.IsExhausted(error))
+            break;
+        if (budget.ShouldWrite())
+            film->Finalize(1.0 / dA / N, false);
+        if (checkpointer.ShouldSave())
+            saveCheckpoint();
+    }
+    if (progressive)
+        LOG("[Rendering]& mutations per pixel in &.1s",
+            nChainMutations * nMarkovChains / Area(filmSize), budget.ElapsedSeconds());
+    if (checkpointer.interval > 0.0f)
+        saveCheckpoint();
+
+    double N = nChainMutations * nMarkovChains;
     film->Finalize(1.0 / dA / N);
+    checkpointer.Wait();
 }
 
 }  // namespace pine
\ No newline at end of file
@@ -3,10 +3,103 @@
 
 namespace pine {
 
+PathIntegrator::PathIntegrator(const Parameters& params, Scene* scene)
+    : RadianceIntegrator(params, scene) {
+    guidingPasses = params.GetInt("guidingPasses", 0);
+    bsdfSamplingFraction = pstd::clamp(params.GetFloat("bsdfSamplingFraction", 0.5f), 0.0f, 1.0f);
+    guide.spatialThreshold = params.GetInt("guidingSpatialThreshold", 12000);
+}
+
+void PathIntegrator::Render() {
+    if (guidingPasses > 0)
+        TrainGuide();
+    PixelIntegrator::Render();
+}
+
+void PathIntegrator::TrainGuide() {
+    Profiler _("Guiding");
+    // Infinite shapes such as planes would leave most of the tree empty
+    AABB bounds, allBounds;
+    for (const Shape& shape : scene->shapes) {
+        AABB aabb = shape.GetAABB();
+        allBounds.Extend(aabb);
+        if (aabb.Diagonal()[aabb.MaxDim()] < 1e+5f)
+            bounds.Extend(aabb);
+    }
+    int spatialThreshold = guide.spatialThreshold;
+    guide = SDTree(bounds.lower.x <= bounds.upper.x ? bounds : allBounds);
+    guide.spatialThreshold = spatialThreshold;
+
+    auto [lower, upper] = film->SampleBounds();
+    // Sample indices start after the final render's so its samples are independent of the guide
+    int firstSample = samplesPerPixel;
+    guiding = training = true;
+    for (int iteration = 0; iteration < guidingPasses; iteration++) {
+        Timer timer;
+        int nSamples = 1 << iteration;
+        ParallelFor(upper - lower,
+                    [&](vec2i p) { ComputePixel(lower + p, firstSample, nSamples); });
+        firstSample += nSamples;
+        guide.Refine(iteration);
+        LOG("[Guiding]Iteration &, & spp, & spatial leaves, &.2s", iteration, nSamples,
+            guide.leaves.size(), timer.ElapsedMs() / 1000.0);
+    }
+    training = false;
+}
+
+pstd::optional<BSDFSample> PathIntegrator::SampleGuided(const DTree& dtree, const Interaction& it,
+                                                        const MaterialEvalCtx& mc, vec3 wi,
+                                                        Sampler& sampler) {
+    // The guide cannot reach specular lobes, so sampling it would only cut such paths short
+    if (!dtree.IsTrained() || it.material->IsSpecular(mc))
+        return it.material->Sample(mc);
+
+    // One-sample MIS: the direction comes from either the material or the guide and is weighted
+    // by the mixture of both densities; specular directions can only come from the material
+    float u = sampler.Get1D();
+    vec2 u2 = sampler.Get2D();
+    pstd::optional<BSDFSample> bs;
+    if (u < bsdfSamplingFraction) {
+        bs = it.material->Sample(mc);
+        if (!bs)
+            return bs;
+        if (bs->isSpecular) {
+            bs->pdf *= bsdfSamplingFraction;
+            return bs;
+        }
+    } else {
+        bs = BSDFSample();
+        bs->wo = dtree.Sample(u2);
+        bs->f = it.material->F(MaterialEvalCtx(it, wi, bs->wo));
+    }
+
+    float materialPdf = it.material->PDF(MaterialEvalCtx(it, wi, bs->wo));
+    float guidePdf = dtree.Pdf(bs->wo);
+    bs->pdf = bsdfSamplingFraction * materialPdf + (1.0f - bsdfSamplingFraction) * guidePdf;
+    if (bs->f.IsBlack() || bs->pdf == 0.0f)
+        return pstd::nullopt;
+    return bs;
+}
+
 Spectrum PathIntegrator::Li(Ray ray, Sampler& sampler) {
     SampledProfiler _(ProfilePhase::EstimateLi);
     Spectrum L(0.0f), beta(1.0f);
-    float bsdfPdf = 0.0f;
+    float bsdfPdf = 0.0f, pathLength = 0.0f;
+    vec3 prevP, prevN;
+    bool specularBounce = false;
+
+    // Radiance arriving at a vertex along the sampled direction is everything gathered after it,
+    // divided by the throughput up to the next vertex
+    struct GuideVertex {
+        int leaf;
+        vec3 wo;
+        float pdf;
+        Spectrum beta;
+        Spectrum L;
+    };
+    static constexpr int maxGuideVertices = 32;
+    GuideVertex vertices[maxGuideVertices];
+    int nVertices = 0;
 
     for (int depth = 0; depth < maxDepth; depth++) {
         Interaction it;
@@ -23,17 +116,22 @@ Spectrum PathIntegrator::Li(Ray ray, Sampler& sampler) {
             vec3 wo;
             bsdfPdf = mi.phaseFunction->Sample(-ray.d, wo, sampler.Get2D());
             ray = mi.SpawnRay(wo);
+            prevP = mi.p;
+            prevN = vec3(0.0f);
+            specularBounce = false;
             continue;
         }
 
         if (!foundIntersection) {
+            RecordAOV(Spectrum(beta).ToRGB(), vec3(0.0f), 0.0f);
             if (scene->envLight) {
                 Spectrum le = scene->envLight->Color(ray.d);
                 if (depth == 0) {
                     L += beta * le;
                 } else {
-                    float lightPdf = scene->envLight->Pdf(ray.d);
-                    L += beta * le * PowerHeuristic(1, bsdfPdf, 1, lightPdf);
+                    float lightPdf = scene->envLight->Pdf(ray.d) *
+                                     LightChoicePdf(prevP, prevN, nullptr);
+                    L += beta * le * ScatteredEmissionWeight(bsdfPdf, lightPdf, specularBounce);
                 }
             }
             break;
@@ -47,14 +145,16 @@ Spectrum PathIntegrator::Li(Ray ray, Sampler& sampler) {
 
         it.n = it.material->BumpNormal(MaterialEvalCtx(it, -ray.d));
         auto mc = MaterialEvalCtx(it, -ray.d);
+        pathLength += Distance(ray.o, it.p);
 
         if (it.material->Is<EmissiveMaterial>()) {
             Spectrum le = it.material->Le(mc);
+            RecordAOV(Spectrum(beta).ToRGB(), it.n, pathLength);
             if (depth == 0) {
                 L += beta * le;
             } else {
-                float lightPdf = it.shape->Pdf(ray, it);
-                L += beta * le * PowerHeuristic(1, bsdfPdf, 1, lightPdf);
+                float lightPdf = it.shape->Pdf(ray, it) * LightChoicePdf(prevP, prevN, it.shape);
+                L += beta * le * ScatteredEmissionWeight(bsdfPdf, lightPdf, specularBounce);
             }
             break;
         }
@@ -62,14 +162,27 @@ Spectrum PathIntegrator::Li(Ray ray, Sampler& sampler) {
         if (depth + 1 == maxDepth)
             break;
 
-        L += beta * EstimateDirect(ray, it, sampler);
+        int leaf = guiding ? guide.Lookup(it.p) : -1;
+        if (leaf != -1)
+            L += beta * EstimateDirect(ray, it, sampler, &guide.Leaf(leaf), bsdfSamplingFraction);
+        else
+            L += beta * EstimateDirect(ray, it, sampler);
 
         mc.u1 = sampler.Get1D();
         mc.u2 = sampler.Get2D();
-        if (auto bs = it.material->Sample(mc)) {
+        auto bs = leaf != -1 ? SampleGuided(guide.Leaf(leaf), it, mc, -ray.d, sampler)
+                             : it.material->Sample(mc);
+        if (bs) {
+            if (!bs->isSpecular)
+                RecordAOV(Spectrum(beta * it.material->Albedo(mc)).ToRGB(), it.n, pathLength);
             beta *= AbsDot(bs->wo, it.n) * bs->f / bs->pdf;
             bsdfPdf = bs->pdf;
             ray = it.SpawnRay(bs->wo);
+            prevP = it.p;
+            prevN = it.n;
+            specularBounce = bs->isSpecular;
+            if (training && !bs->isSpecular && nVertices < maxGuideVertices)
+                vertices[nVertices++] = {leaf, bs->wo, bs->pdf, beta, L};
 
             if (depth > 2) {
                 float q = pstd::clamp(1.0f - beta.y(), 0.05f, 1.0f);
@@ -83,6 +196,13 @@ Spectrum PathIntegrator::Li(Ray ray, Sampler& sampler) {
         }
     }
 
+    for (int i = 0; i < nVertices; i++) {
+        const GuideVertex& v = vertices[i];
+        float radiance = Spectrum(L - v.L).y();
+        if (radiance > 0.0f && v.beta.y() > 0.0f)
+            guide.Record(v.leaf, v.wo, radiance / (v.beta.y() * v.pdf));
+    }
+
     return L;
 }
 
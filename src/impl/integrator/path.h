@@ -2,14 +2,28 @@
 #define PINE_IMPL_INTEGRATOR_PATH_H
 
 #include <core/integrator.h>
+#include <core/guiding.h>
 
 namespace pine {
 
 struct PathIntegrator : RadianceIntegrator {
-    using RadianceIntegrator::RadianceIntegrator;
+    PathIntegrator(const Parameters& params, Scene* scene);
+    void Render() override;
     Spectrum Li(Ray ray, Sampler& sampler) override;
+
+    // Learns the SDTree over `guidingPasses` passes of 1, 2, 4... samples per pixel whose images
+    // are discarded; the final render samples it but does not update it
+    void TrainGuide();
+    pstd::optional<BSDFSample> SampleGuided(const DTree& dtree, const Interaction& it,
+                                            const MaterialEvalCtx& mc, vec3 wi, Sampler& sampler);
+
+    SDTree guide;
+    int guidingPasses = 0;
+    float bsdfSamplingFraction = 0.5f;
+    bool guiding = false;
+    bool training = false;
 };
 
 }  // namespace pine
 
-#endif  // PINE_IMPL_INTEGRATOR_PATH_H
\ No newline at end of file
+#endif  // PINE_IMPL_INTEGRATOR_PATH_H
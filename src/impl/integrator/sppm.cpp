@@ -3,6 +3,7 @@
 #include <core/scene.h>
 #include <util/distribution.h>
 #include <util/parameters.h>
+#include <util/archive.h>
 
 namespace pine {
 
@@ -10,6 +11,7 @@ SPPMIntegrator::SPPMIntegrator(const Parameters& params, Scene* scene)
     : RayIntegrator(params, scene) {
     initialSearchRadius = params.GetFloat("initialSearchRadius", 0.1f);
     nIterations = params.GetInt("nIterations", samplesPerPixel);
+    checkpointer.key.samplesPerPixel = nIterations;
     photonsPerIteration = params.GetInt("photonsPerIteration", filmSize.x * filmSize.y);
     finalGatheringDepth = params.GetInt("finalGatheringDepth", 0);
     writeFrequency = params.GetInt("writeFrequency", -1);
@@ -26,6 +28,7 @@ struct SPPMPixel {
     } vp;
 
     Spectrum Ld;
+    float prevLdY = 0;
     float radius = 0;
     AtomicFloat phi[Spectrum::nSamples];
     std::atomic<int> M{0};
@@ -33,6 +36,13 @@ struct SPPMPixel {
     Spectrum tau;
 };
 
+struct SPPMState {
+    PSTD_ARCHIVE(radius, N, prevLdY, Ld, tau)
+
+    pstd::vector<float> radius, N, prevLdY;
+    pstd::vector<Spectrum> Ld, tau;
+};
+
 struct SPPMPixelListNode {
     SPPMPixel* pixel = nullptr;
     SPPMPixelListNode* next = nullptr;
@@ -56,25 +66,83 @@ static inline unsigned int HashVec3i(vec3i p, int hashSize) {
 }
 
 void SPPMIntegrator::Render() {
+    Profiler _("Rendering");
     if (scene->lights.size() == 0)
         LOG_FATAL("[SPPMIntegrator][Render]No light in the scene");
+    film->DisableTiling();
+    if (shardCount > 1)
+        LOG_WARNING("[SPPMIntegrator][Render]Sharding is unsupported, rendering the full image");
     int nPixels = Area(filmSize);
     pstd::unique_ptr<SPPMPixel[]> pixels(new SPPMPixel[nPixels]);
     for (int i = 0; i < nPixels; i++)
         pixels[i].radius = initialSearchRadius;
 
+    bool progressive = budget.IsProgressive();
+    int maxIterations =
+        budget.HasTimeLimit() ? pstd::numeric_limits<int>::max() : nIterations;
     ProgressReporter pr("Rendering", "SPPMIterations", "Photons", nIterations, photonsPerIteration);
+    auto [cropMin, cropMax] = film->CropBounds();
+    vec2i cropSize = cropMax - cropMin;
+    ConvergenceEstimator estimator(progressive ? Area(cropSize) : 0);
+    budget.Start();
+
+    auto writeImage = [&](int nIters, bool newFrame) {
+        film->Clear();
+        uint64_t Np = (uint64_t)nIters * (uint64_t)photonsPerIteration;
+        for (int i = 0; i < nPixels; i++) {
+            const SPPMPixel& pixel = pixels[i];
+            Spectrum L = pixel.Ld / nIters;
+            L += pixel.tau / (Np * Pi * pstd::sqr(pixel.radius));
+            vec3 rgb = L.ToRGB();
+            film->GetPixel({i % filmSize.x, i / filmSize.x}).rgb[0].Add(rgb[0]);
+            film->GetPixel({i % filmSize.x, i / filmSize.x}).rgb[1].Add(rgb[1]);
+            film->GetPixel({i % filmSize.x, i / filmSize.x}).rgb[2].Add(rgb[2]);
+            film->GetPixel({i % filmSize.x, i / filmSize.x}).weight = 1.0f;
+        }
+        film->Finalize(1.0f, newFrame);
+    };
+
+    auto saveCheckpoint = [&](int nIters) {
+        SPPMState state;
+        for (int i = 0; i < nPixels; i++) {
+            state.radius.push_back(pixels[i].radius);
+            state.N.push_back(pixels[i].N);
+            state.prevLdY.push_back(pixels[i].prevLdY);
+            state.Ld.push_back(pixels[i].Ld);
+            state.tau.push_back(pixels[i].tau);
+        }
+        checkpointer.SaveAsync({nIters, {}, Archive(state)});
+    };
+
+    int startIteration = 0;
+    if (auto checkpoint = checkpointer.Load()) {
+        auto state = Unarchive<SPPMState>(checkpoint->state);
+        if ((int)state.radius.size() == nPixels) {
+            startIteration = checkpoint->passIndex;
+            for (int i = 0; i < nPixels; i++) {
+                pixels[i].radius = state.radius[i];
+                pixels[i].N = state.N[i];
+                pixels[i].prevLdY = state.prevLdY[i];
+                pixels[i].Ld = state.Ld[i];
+                pixels[i].tau = state.tau[i];
+            }
+        } else {
+            LOG_WARNING("[SPPMIntegrator][Render]Checkpoint does not match the film size");
+        }
+    }
 
     int hashSize = nPixels;
     pstd::vector<pstd::vector<SPPMPixelListNode>> grids = {
         pstd::vector<SPPMPixelListNode>(hashSize)};
 
-    for (int iter = 0; iter < nIterations; iter++) {
-        ScopedPR(pr, iter, iter == nIterations - 1);
+    int nCompleted = startIteration;
+    for (int iter = startIteration; iter < maxIterations; iter++) {
+        ScopedPR(pr, iter, !progressive && iter == nIterations - 1, !progressive);
 
         {
             Profiler _("Accumulating Visible Points");
-            ParallelFor(filmSize, [&](vec2i p) {
+            ParallelFor(cropSize, [&](vec2i p) {
+                p += cropMin;
                 auto& sampler = samplers[threadIdx];
                 sampler.StartPixel(p, iter);
 
@@ -85,6 +153,8 @@ void SPPMIntegrator::Render() {
 
                 Spectrum beta(1.0f);
                 float bsdfPdf = 0.0f;
+                vec3 prevP, prevN;
+                bool specularBounce = false;
                 int diffuseBounces = 0;
 
                 for (int depth = 0; depth < maxDepth; depth++) {
@@ -109,8 +179,10 @@ void SPPMIntegrator::Render() {
                         if (depth == 0) {
                             pixel.Ld += beta * le;
                         } else {
-                            float lightPdf = it.shape->Pdf(ray, it);
-                            pixel.Ld += beta * le * PowerHeuristic(1, bsdfPdf, 1, lightPdf);
+                            float lightPdf = it.shape->Pdf(ray, it) *
+                                             LightChoicePdf(prevP, prevN, it.shape);
+                            pixel.Ld += beta * le * ScatteredEmissionWeight(bsdfPdf, lightPdf,
+                                                                            specularBounce);
                         }
                         break;
                     }
@@ -133,6 +205,9 @@ void SPPMIntegrator::Render() {
                         beta *= AbsDot(bs->wo, it.n) * bs->f / bs->pdf;
                         bsdfPdf = bs->pdf;
                         ray = it.SpawnRay(bs->wo);
+                        prevP = it.p;
+                        prevN = it.n;
+                        specularBounce = bs->isSpecular;
                     } else {
                         break;
                     }
@@ -267,6 +342,19 @@ void SPPMIntegrator::Render() {
             Profiler _("Update Pixel Values From Photons");
             for (int i = 0; i < nPixels; i++) {
                 SPPMPixel& p = pixels[i];
+                vec2i pCrop = vec2i(i % filmSize.x, i / filmSize.x) - cropMin;
+                if (progressive && Inside(pCrop, vec2i(0), cropSize)) {
+                    float Ly = p.Ld.y() - p.prevLdY;
+                    if (p.M > 0.0f) {
+                        Spectrum phi;
+                        for (int j = 0; j < Spectrum::nSamples; j++)
+                            phi[j] = p.phi[j];
+                        Spectrum L = p.vp.beta * phi;
+                        Ly += L.y() / (photonsPerIteration * Pi * pstd::sqr(p.radius));
+                    }
+                    estimator.Add(pCrop.x + pCrop.y * cropSize.x, Ly);
+                    p.prevLdY = p.Ld.y();
+                }
                 if (p.M > 0.0f) {
                     float gamma = 1.5f / 3.0f;
                     float Nnew = p.N + gamma * p.M;
@@ -286,24 +374,34 @@ void SPPMIntegrator::Render() {
             }
         }
 
+        nCompleted = iter + 1;
+
         // Write Image
-        if (iter + 1 == nIterations || ((iter + 1) % writeFrequency) == 0) {
-            film->Clear();
-            uint64_t Np = (uint64_t)(iter + 1) * (uint64_t)photonsPerIteration;
-            for (int i = 0; i < nPixels; i++) {
-                const SPPMPixel& pixel = pixels[i];
-                Spectrum L = pixel.Ld / (iter + 1);
-                L += pixel.tau / (Np * Pi * pstd::sqr(pixel.radius));
-                vec3 rgb = L.ToRGB();
-                film->GetPixel({i % filmSize.x, i / filmSize.x}).rgb[0].Add(rgb[0]);
-                film->GetPixel({i % filmSize.x, i / filmSize.x}).rgb[1].Add(rgb[1]);
-                film->GetPixel({i % filmSize.x, i / filmSize.x}).rgb[2].Add(rgb[2]);
-                film->GetPixel({i % filmSize.x, i / filmSize.x}).weight = 1.0f;
+        if (progressive) {
+            estimator.EndPass();
+            float error = estimator.RelativeError();
+            LOG_SAMELINE("[Rendering]SPPMIterations[&]  Time[&.1s]  Error[&.4]", iter + 1,
+                         budget.ElapsedSeconds(), error);
+            if (iter + 1 == maxIterations || budget.IsExhausted(error)) {
+                LOG("[Rendering]& SPPM iterations in &.1s", iter + 1, budget.ElapsedSeconds());
+                writeImage(iter + 1, true);
+                break;
             }
-            film->Finalize();
+            if (budget.ShouldWrite())
+                writeImage(iter + 1, false);
+        } else if (iter + 1 == nIterations || ((iter + 1) % writeFrequency) == 0) {
+            writeImage(iter + 1, true);
         }
 
+        if (checkpointer.ShouldSave())
+            saveCheckpoint(iter + 1);
     }  // nIteration
+
+    if (nCompleted == startIteration && nCompleted != 0)
+        writeImage(nCompleted, true);
+    if (checkpointer.interval > 0.0f)
+        saveCheckpoint(nCompleted);
+    checkpointer.Wait();
 }
 
 }  // namespace pine
\ No newline at end of file
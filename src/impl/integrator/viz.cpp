@@ -27,6 +27,8 @@ Spectrum VizIntegrator::Li(Ray ray, Sampler&) {
 
     if (!Intersect(ray, it) && type != Type::Bvh)
         return Spectrum(0.0f);
+    if (type != Type::Bvh)
+        RecordAOV(vec3(1.0f), it.n, Distance(ray.o, it.p));
 
     switch (type) {
     case Type::Bvh: return ColorMap(it.bvh / 200.0f);
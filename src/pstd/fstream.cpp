@@ -58,6 +58,14 @@ size_t fstream::size() const {
     return size_;
 }
 
+void fstream::seek(size_t pos) {
+#ifdef _WIN32
+    _fseeki64((FILE*)file, pos, SEEK_SET);
+#else
+    fseeko((FILE*)file, pos, SEEK_SET);
+#endif
+}
+
 void fstream::write(const void* data, size_t size) {
     fwrite(data, size, 1, (FILE*)file);
 }
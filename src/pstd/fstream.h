@@ -40,6 +40,7 @@ class fstream {
 
     size_t size() const;
 
+    void seek(size_t pos);
     void write(const void* data, size_t size);
     void read(void* data, size_t size) const;
 
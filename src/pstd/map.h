@@ -9,6 +9,9 @@ namespace pstd {
 template <typename Key, typename Value, typename Pred = less<Key>>
 class map {
   public:
+    using key_type = Key;
+    using mapped_type = Value;
+
     struct Node {
         pair<Key, Value> key_value;
         Node* children[2] = {};
@@ -138,16 +138,13 @@ inline constexpr T absfract(T v) {
     return v - (corresponding_uint_t<T>)v;
 }
 
+// The instruction is exact and a fraction of the latency of Newton's method
 template <typename T, typename = enable_if_t<is_floating_point_v<T>>>
 inline T sqrt(T y) {
-    T x = pstd::exp2i(pstd::ieeeexp(y) / 2);
-
-    x = x / 2 + y / (2 * x);
-    x = x / 2 + y / (2 * x);
-    x = x / 2 + y / (2 * x);
-    x = x / 2 + y / (2 * x);
-
-    return x;
+    if constexpr (is_same_v<T, float>)
+        return __builtin_sqrtf(y);
+    else
+        return __builtin_sqrt(y);
 }
 
 template <typename T>
@@ -228,6 +225,14 @@ inline T log2int(T y) {
 
 template <typename T, typename = enable_if_t<is_floating_point_v<T>>>
 inline T exp(T x) {
+    // The series is only accurate near 0, so exp(x) = 2^k * exp(x - k * ln2) with |x - k * ln2|
+    // at most ln2 / 2, and k kept within the normal exponent range
+    if (x < -87)
+        return 0;
+    x = pstd::min(x, T(88));
+    int k = pstd::floor(x / Ln2 + T(0.5));
+    x -= k * Ln2;
+
     T y = 0;
 
     const int n = 8;
@@ -235,7 +240,7 @@ inline T exp(T x) {
     for (int i = n; i > 0; --i)
         y = 1 + x * y / i;
 
-    return y;
+    return y * pstd::exp2i(k);
 }
 
 template <typename T, typename = enable_if_t<is_floating_point_v<T>>>
@@ -248,8 +253,9 @@ inline bool isinf(T x) {
     return __builtin_isinf(x);
 }
 
+// Both series are only evaluated on [0, Pi / 4], where they are accurate to float precision
 template <typename T, typename = enable_if_t<is_floating_point_v<T>>>
-inline T cos_0_pi_2(T x) {
+inline T cos_0_pi_4(T x) {
     T y = 1;
 
     const int n = 8;
@@ -259,25 +265,56 @@ inline T cos_0_pi_2(T x) {
     return y;
 }
 
+template <typename T, typename = enable_if_t<is_floating_point_v<T>>>
+inline T sin_0_pi_4(T x) {
+    T y = 1;
+
+    const int n = 9;
+    for (int i = n; i > 1; i -= 2)
+        y = 1 - y * x * x / (i * (i - 1));
+
+    return y * x;
+}
+
 template <typename T, typename = enable_if_t<is_floating_point_v<T>>>
 inline T cos(T x) {
     if (x < 0)
         x = -x;
     // TODO
-    corresponding_uint_t<T> y = x / (Pi * 2);
-    x -= y * (Pi * 2);
+    if (x > Pi * 2) {
+        corresponding_uint_t<T> y = x / (Pi * 2);
+        x -= y * (Pi * 2);
+    }
     if (x > Pi)
         x = Pi * 2 - x;
 
-    if (x < Pi / 2)
-        return cos_0_pi_2(x);
-    else
-        return -cos_0_pi_2(Pi - x);
+    T sign = 1;
+    if (x > Pi / 2) {
+        x = Pi - x;
+        sign = -1;
+    }
+    return sign * (x < Pi / 4 ? cos_0_pi_4(x) : sin_0_pi_4(Pi / 2 - x));
 }
 
 template <typename T, typename = enable_if_t<is_floating_point_v<T>>>
 inline T sin(T x) {
-    return pstd::cos(x - Pi / 2);
+    T sign = 1;
+    if (x < 0) {
+        x = -x;
+        sign = -1;
+    }
+    if (x > Pi * 2) {
+        corresponding_uint_t<T> y = x / (Pi * 2);
+        x -= y * (Pi * 2);
+    }
+    if (x > Pi) {
+        x -= Pi;
+        sign = -sign;
+    }
+    if (x > Pi / 2)
+        x = Pi - x;
+
+    return sign * (x < Pi / 4 ? sin_0_pi_4(x) : cos_0_pi_4(Pi / 2 - x));
 }
 
 template <typename T, typename = enable_if_t<is_floating_point_v<T>>>
@@ -286,68 +323,54 @@ inline T tan(T x) {
     return pstd::sin(x) / pstd::cos(x);
 }
 
+// Abramowitz and Stegun 4.4.49, accurate to 2e-8 on [0, 1]
 template <typename T, typename = enable_if_t<is_floating_point_v<T>>>
-inline T acos(T y) {
-    // TODO
-    if (y < -1 || y > 1)
-        return 0;
-
-    T x = (1 - y) * Pi / 2;
-
-    const int n = 8;
-
-    for (int i = 0; i < n; ++i) {
-        T y_ = pstd::cos(x) - y;
-        T dydx = -pstd::sin(x);
-        x -= y_ / dydx;
-    }
+inline T atan_0_1(T x) {
+    T z = x * x;
+    T y = T(0.0028662257);
+    y = y * z - T(0.0161657367);
+    y = y * z + T(0.0429096138);
+    y = y * z - T(0.0752896400);
+    y = y * z + T(0.1065626393);
+    y = y * z - T(0.1420889944);
+    y = y * z + T(0.1999355085);
+    y = y * z - T(0.3333314528);
+    return x * (y * z + 1);
+}
+
+// Both are reduced to [0, 1] and folded back with arithmetic rather than branches, as the signs
+// and ranges of their arguments are too random to be predicted
+template <typename T, typename = enable_if_t<is_floating_point_v<T>>>
+inline T atan(T x) {
+    T ax = pstd::abs(x);
+    T y = pstd::atan_0_1(pstd::min(ax, T(1)) / pstd::max(ax, T(1)));
+    T large = ax > 1, negative = x < 0;
+    y = large * (Pi / 2) + (1 - 2 * large) * y;
+    return (1 - 2 * negative) * y;
+}
 
-    return x;
+template <typename T, typename = enable_if_t<is_floating_point_v<T>>>
+inline T atan2(T y, T x) {
+    T ax = pstd::abs(x), ay = pstd::abs(y);
+    T r = pstd::atan_0_1(pstd::min(ax, ay) / pstd::max(pstd::max(ax, ay), T(1e-30)));
+    T swapped = ay > ax, left = x < 0, negative = y < 0;
+    r = swapped * (Pi / 2) + (1 - 2 * swapped) * r;
+    r = left * Pi + (1 - 2 * left) * r;
+    return (1 - 2 * negative) * r;
 }
 
 template <typename T, typename = enable_if_t<is_floating_point_v<T>>>
 inline T asin(T y) {
-    // TODO
     if (y < -1 || y > 1)
         return 0;
-
-    T x = y * Pi / 2;
-
-    const int n = 8;
-
-    for (int i = 0; i < n; ++i) {
-        T y_ = pstd::sin(x) - y;
-        T dydx = pstd::cos(x);
-        x -= y_ / dydx;
-    }
-
-    return x;
+    return pstd::atan2(y, pstd::sqrt((1 - y) * (1 + y)));
 }
 
 template <typename T, typename = enable_if_t<is_floating_point_v<T>>>
-inline T atan(T y) {
-    // TODO
-    T x = (y > 0 ? 1 - 1 / (1 + y) : -1 + 1 / (1 - y)) * Pi / 2;
-
-    const int n = 8;
-
-    for (int i = 0; i < n; ++i) {
-        T y_ = pstd::tan(x) - y;
-        T dydx = 1.0f / pstd::sqr(pstd::cos(x));
-        x -= y_ / dydx;
-    }
-
-    return x;
-}
-
-template <typename T, typename = enable_if_t<is_floating_point_v<T>>>
-inline T atan2(T y, T x) {
-    if (x > 0)
-        return pstd::atan(y / x);
-    else if (y > 0)
-        return Pi - pstd::atan(-y / x);
-    else
-        return -Pi - pstd::atan(-y / x);
+inline T acos(T y) {
+    if (y < -1 || y > 1)
+        return 0;
+    return pstd::atan2(pstd::sqrt((1 - y) * (1 + y)), y);
 }
 
 }  // namespace pstd
@@ -3,7 +3,7 @@
 
 //#include <execinfo.h>
 //#include <cxxabi.h>
-//#include <stdlib.h>
+#include <stdlib.h>
 
 namespace pstd {
 
@@ -89,6 +89,10 @@ inline constexpr bool is_function_v = is_function<T>::value;
 template <typename T>
 struct is_integral : false_type {};
 template <>
+struct is_integral<bool> : true_type {};
+template <>
+struct is_integral<char> : true_type {};
+template <>
 struct is_integral<int8_t> : true_type {};
 template <>
 struct is_integral<int16_t> : true_type {};
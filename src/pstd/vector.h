@@ -191,6 +191,9 @@ class vector_base {
         return len;
     }
 
+    T* data() {
+        return ptr;
+    }
     const T* data() const {
         return ptr;
     }
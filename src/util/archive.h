@@ -71,7 +71,11 @@ class ArchiverBase {
     void ArchiveImpl(Ty&& object) {
         using T = pstd::decay_t<Ty>;
 
-        if constexpr (pstd::is_arithmetic_v<T>) {
+        if constexpr (pstd::is_array_v<pstd::remove_reference_t<Ty>>) {
+            for (auto&& element : object)
+                ArchiveImpl(element);
+
+        } else if constexpr (pstd::is_arithmetic_v<T>) {
             strategy.Add(pstd::forward<Ty>(object));
 
         } else if constexpr (IsMap<T>::value) {
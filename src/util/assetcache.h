@@ -0,0 +1,91 @@
+#ifndef PINE_UTIL_ASSETCACHE_H
+#define PINE_UTIL_ASSETCACHE_H
+
+#include <util/misc.h>
+#include <util/rng.h>
+#include <util/log.h>
+
+#include <pstd/memory.h>
+#include <pstd/map.h>
+#include <pstd/vector.h>
+
+namespace pine {
+
+inline uint64_t HashBuffer(const void* data, size_t size) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    uint64_t h = Hash64u(size);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        pstd::memcpy(&word, bytes + i, 8);
+        h = Hash64u(h ^ word);
+    }
+    uint64_t tail = 0;
+    pstd::memcpy(&tail, bytes + i, size - i);
+    return Hash64u(h ^ tail);
+}
+
+// Assets shared by the scenes of a batch render, keyed by a hash of the data they are created
+// from so identical files are loaded once even when they are referenced under different paths
+// (volumes, too large to read just for the key, are keyed by path instead); only used when
+// enabled, a single render does not keep its assets alive
+struct AssetCache {
+    template <typename T, typename F>
+    static pstd::shared_ptr<T> FindOrCreate(uint64_t key, F&& create) {
+        if (!enabled)
+            return pstd::make_shared<T>(create());
+        auto& storage = Storage<T>();
+        if (auto it = storage.find(key); it != storage.end()) {
+            hits++;
+            it->second.lastScene = scene;
+            return it->second.asset;
+        }
+        auto asset = pstd::make_shared<T>(create());
+        storage[key] = {asset, scene};
+        return asset;
+    }
+
+    // Called after each scene of a batch; releases the assets that none of the last
+    // `maxIdleScenes` scenes used, so the cache only grows with the assets of recent scenes
+    static void EndScene() {
+        scene++;
+        for (auto evict : evictors)
+            evict();
+    }
+
+    static inline bool enabled = false;
+    static inline int maxIdleScenes = 1;
+    static inline int hits = 0;
+    static inline int evictions = 0;
+
+  private:
+    template <typename T>
+    struct Entry {
+        pstd::shared_ptr<T> asset;
+        int lastScene = 0;
+    };
+
+    template <typename T>
+    static pstd::map<uint64_t, Entry<T>>& Storage() {
+        static pstd::map<uint64_t, Entry<T>> storage;
+        [[maybe_unused]] static bool registered = (evictors.push_back(&Evict<T>), true);
+        return storage;
+    }
+    template <typename T>
+    static void Evict() {
+        auto& storage = Storage<T>();
+        pstd::map<uint64_t, Entry<T>> kept;
+        for (auto& item : storage)
+            if (scene - item.second.lastScene <= maxIdleScenes)
+                kept.insert(item);
+        evictions += storage.size() - kept.size();
+        storage = pstd::move(kept);
+    }
+
+    static inline pstd::vector<void (*)()> evictors;
+    static inline int scene = 0;
+};
+
+}  // namespace pine
+
+#endif  // PINE_UTIL_ASSETCACHE_H
@@ -1,7 +1,9 @@
 #ifndef PINE_UTIL_DISTRIBUTION_H
 #define PINE_UTIL_DISTRIBUTION_H
 
+#include <core/vecmath.h>
 #include <core/math.h>
+#include <util/log.h>
 
 #include <pstd/vector.h>
 
@@ -21,6 +23,7 @@ struct Distribution1D {
         if (funcInt != 0)
             for (int i = 0; i < n + 1; i++)
                 cdf[i] /= funcInt;
+        BuildAliasTable();
     }
     int Count() const {
         return (int)func.size();
@@ -36,7 +39,7 @@ struct Distribution1D {
         float du = u - cdf[offset];
         if (cdf[offset + 1] - cdf[offset] > 0)
             du /= cdf[offset + 1] - cdf[offset];
-        pdf = func[offset];
+        pdf = func[offset] / funcInt;
 
         return pstd::min((offset + du) / Count(), OneMinusEpsilon);
     }
@@ -53,8 +56,120 @@ struct Distribution1D {
         return offset;
     }
 
+    // Same distributions as SampleContinuous() and SampleDiscrete() in constant time through the
+    // alias table; the mapping from `u` is not monotonic, so stratification of `u` is not kept
+    float SampleContinuousAlias(float u, float& pdf, int* offset = nullptr) const {
+        float du;
+        int i = SampleDiscreteAlias(u, pdf, &du);
+        pdf *= Count();
+        if (offset)
+            *offset = i;
+        return pstd::min((i + du) / Count(), OneMinusEpsilon);
+    }
+    int SampleDiscreteAlias(float u, float& p, float* uRemapped = nullptr) const {
+        int n = Count();
+        int offset = pstd::min(int(u * n), n - 1);
+        float up = pstd::min(u * n - offset, OneMinusEpsilon);
+        const AliasBin& bin = aliases[offset];
+        if (up < bin.q) {
+            up /= bin.q;
+        } else {
+            up = (up - bin.q) / (1.0f - bin.q);
+            offset = bin.alias;
+        }
+        if (uRemapped)
+            *uRemapped = pstd::min(up, OneMinusEpsilon);
+        p = funcInt != 0 ? func[offset] / (funcInt * n) : 1.0f / n;
+        return offset;
+    }
+
+    float Pdf(float x) const {
+        if (funcInt == 0)
+            return 1.0f;
+        int offset = pstd::clamp(int(x * Count()), 0, Count() - 1);
+        return func[offset] / funcInt;
+    }
+
+    // Each bin is kept with probability `q` and replaced by `alias` otherwise
+    struct AliasBin {
+        float q = 1.0f;
+        int alias = 0;
+    };
+
     pstd::vector<float> func, cdf;
-    float funcInt;
+    pstd::vector<AliasBin> aliases;
+    float funcInt = 0.0f;
+
+  private:
+    // Vose's method: bins below the average probability are topped up by one above it
+    void BuildAliasTable() {
+        int n = Count();
+        aliases.resize(n);
+        for (int i = 0; i < n; i++)
+            aliases[i] = {1.0f, i};
+        if (funcInt == 0)
+            return;
+
+        pstd::vector<float> scaled(n);
+        pstd::vector<int> under(n), over(n);
+        int nUnder = 0, nOver = 0;
+        for (int i = 0; i < n; i++) {
+            scaled[i] = func[i] / funcInt;
+            if (scaled[i] < 1.0f)
+                under[nUnder++] = i;
+            else
+                over[nOver++] = i;
+        }
+        while (nUnder && nOver) {
+            int u = under[--nUnder], o = over[--nOver];
+            aliases[u] = {scaled[u], o};
+            scaled[o] += scaled[u] - 1.0f;
+            if (scaled[o] < 1.0f)
+                under[nUnder++] = o;
+            else
+                over[nOver++] = o;
+        }
+    }
+};
+
+struct Distribution2D {
+    Distribution2D() = default;
+    Distribution2D(const float* f, int nu, int nv) {
+        pstd::vector<float> marginalFunc(nv);
+        for (int v = 0; v < nv; v++) {
+            pConditionalV.push_back(Distribution1D(&f[v * nu], nu));
+            marginalFunc[v] = pConditionalV[v].funcInt;
+        }
+        pMarginal = Distribution1D(&marginalFunc[0], nv);
+    }
+
+    // return PDF(x, y)
+    vec2 SampleContinuous(vec2 u, float& pdf) const {
+        float pdfs[2];
+        float d1 = pMarginal.SampleContinuous(u[1], pdfs[1]);
+        int v = pstd::min(int(d1 * pMarginal.Count()), pMarginal.Count() - 1);
+        float d0 = pConditionalV[v].SampleContinuous(u[0], pdfs[0]);
+        pdf = pdfs[0] * pdfs[1];
+        return {d0, d1};
+    }
+
+    // Constant-time alternative to SampleContinuous(), see Distribution1D
+    vec2 SampleContinuousAlias(vec2 u, float& pdf) const {
+        float pdfs[2];
+        int v;
+        float d1 = pMarginal.SampleContinuousAlias(u[1], pdfs[1], &v);
+        float d0 = pConditionalV[v].SampleContinuousAlias(u[0], pdfs[0]);
+        pdf = pdfs[0] * pdfs[1];
+        return {d0, d1};
+    }
+
+    float Pdf(vec2 p) const {
+        int v = pstd::clamp(int(p[1] * pMarginal.Count()), 0, pMarginal.Count() - 1);
+        return pConditionalV[v].Pdf(p[0]) * pMarginal.Pdf(p[1]);
+    }
+
+    pstd::vector<Distribution1D> pConditionalV;
+    Distribution1D pMarginal;
 };
 
 }  // namespace pine
@@ -4,17 +4,27 @@
 #include <util/huffman.h>
 #include <util/fileio.h>
 #include <util/parser.h>
+#include <util/parallel.h>
 #include <util/misc.h>
 #include <util/log.h>
 
+#include <condition_variable>
+#include <thread>
+#include <mutex>
+#include <stdio.h>
+
 namespace pine {
 
 pstd::string sceneDirectory = "";
 
+pstd::string ResolveFilePath(pstd::string_view filename) {
+    auto path = sceneDirectory + (pstd::string)filename;
+    pstd::replace(path.begin(), path.end(), '\\', '/');
+    return path;
+}
+
 ScopedFile::ScopedFile(pstd::string_view filename_view, pstd::ios::openmode mode) {
-    auto filename = (pstd::string)filename_view;
-    filename = sceneDirectory + filename;
-    pstd::replace(filename.begin(), filename.end(), '\\', '/');
+    auto filename = ResolveFilePath(filename_view);
     CHECK(filename != "");
     file.open(filename.c_str(), mode);
     if (file.is_open() == false)
@@ -28,6 +38,10 @@ void ScopedFile::Read(void *data, size_t size) {
     if (file.is_open())
         file.read((char *)data, size);
 }
+void ScopedFile::Seek(size_t pos) {
+    if (file.is_open())
+        file.seek(pos);
+}
 
 bool IsFileExist(pstd::string_view filename_view) {
     auto filename = (pstd::string)filename_view;
@@ -78,6 +92,12 @@ void WriteBinaryData(pstd::string_view filename, const void *ptr, size_t size) {
     ScopedFile file(filename, pstd::ios::binary | pstd::ios::out);
     file.Write((const char *)ptr, size);
 }
+void RenameFile(pstd::string_view from, pstd::string_view to) {
+    auto src = sceneDirectory + (pstd::string)from;
+    auto dst = sceneDirectory + (pstd::string)to;
+    if (::rename(src.c_str(), dst.c_str()) != 0)
+        LOG_WARNING("[RenameFile]Can not rename \"&\" to \"&\"", src, dst);
+}
 pstd::vector<char> ReadBinaryData(pstd::string_view filename) {
     ScopedFile file(filename, pstd::ios::binary | pstd::ios::in);
     pstd::vector<char> data(file.Size());
@@ -85,20 +105,19 @@ pstd::vector<char> ReadBinaryData(pstd::string_view filename) {
     return data;
 }
 
-void WriteImageBMP(pstd::string_view filename, vec2i size, int nchannel, const uint8_t *data) {
-    ScopedFile file(filename, pstd::ios::out);
-
-    pstd::vector<vec3u8> colors(size.x * size.y);
-    for (int x = 0; x < size.x; x++)
-        for (int y = 0; y < size.y; y++) {
-            vec3u8 c;
-            c.z = data[(x + y * size.x) * nchannel + 0];
-            c.y = data[(x + y * size.x) * nchannel + 1];
-            c.x = data[(x + y * size.x) * nchannel + 2];
-            colors[x + (size.y - 1 - y) * size.x] = c;
-        }
-
-    int filesize = 54 + 3 * size.x * size.y;
+static size_t BMPRowStride(int width) {
+    return size_t(width) * 3 + (4 - size_t(width) * 3 % 4) % 4;
+}
+// The file size and the dimensions of a BMP are 32-bit fields
+static bool FitsBMP(pstd::string_view filename, vec2i size) {
+    if (size.x > 0 && size.y > 0 && 54 + BMPRowStride(size.x) * size.y <= 0xffffffffu)
+        return true;
+    LOG_WARNING("[FileIO]Can not write \"&\", & pixels exceed the 4 GB limit of BMP", filename,
+                size);
+    return false;
+}
+static void WriteBMPHeader(ScopedFile &file, vec2i size) {
+    uint32_t filesize = 54 + BMPRowStride(size.x) * size.y;
     uint8_t header[] = {'B',
                         'M',
                         (uint8_t)(filesize),
@@ -154,25 +173,42 @@ void WriteImageBMP(pstd::string_view filename, vec2i size, int nchannel, const u
                         0,
                         0};
     file.Write(header, sizeof(header));
+}
+void WriteImageBMP(pstd::string_view filename, vec2i size, int nchannel, const uint8_t *data) {
+    if (!FitsBMP(filename, size))
+        return;
+    ScopedFile file(filename, pstd::ios::out);
+
+    pstd::vector<vec3u8> colors(size_t(size.x) * size.y);
+    for (int x = 0; x < size.x; x++)
+        for (int y = 0; y < size.y; y++) {
+            const uint8_t *src = data + (x + size_t(y) * size.x) * nchannel;
+            colors[x + size_t(size.y - 1 - y) * size.x] = vec3u8(src[2], src[1], src[0]);
+        }
+
+    WriteBMPHeader(file, size);
 
     uint8_t padding[3] = {0, 0, 0};
-    size_t paddingSize = (4 - (size.x * 3) % 4) % 4;
+    size_t paddingSize = BMPRowStride(size.x) - size_t(size.x) * 3;
     if (paddingSize == 0) {
         file.Write(colors.data(), sizeof(colors[0]) * colors.size());
     } else {
         for (int y = 0; y < size.y; y++) {
-            file.Write(colors.data() + y * size.x * 3, size.x * 3);
+            file.Write(colors.data() + size_t(y) * size.x, size_t(size.x) * 3);
             file.Write(padding, paddingSize);
         }
     }
 }
+static void ConvertToLDR(const float *data, uint8_t *pixels, int count) {
+    for (int i = 0; i < count; i++)
+        pixels[i] = pstd::clamp(data[i] * 256.0f, 0.0f, 255.0f);
+}
 void SaveImage(pstd::string_view filename, vec2i size, int nchannel, const float *data) {
     pstd::vector<uint8_t> pixels(Area(size) * nchannel);
-    for (int x = 0; x < size.x; x++)
-        for (int y = 0; y < size.y; y++)
-            for (int c = 0; c < nchannel; c++)
-                pixels[y * size.x * nchannel + x * nchannel + c] = pstd::clamp(
-                    data[y * size.x * nchannel + x * nchannel + c] * 256.0f, 0.0f, 255.0f);
+    int rowSize = size.x * nchannel;
+    ParallelFor(size.y, [&](int y) {
+        ConvertToLDR(data + y * rowSize, &pixels[y * rowSize], rowSize);
+    });
     SaveImage(filename, size, nchannel, pixels.data());
 }
 void SaveImage(pstd::string_view filename, vec2i size, int nchannel, const uint8_t *data) {
@@ -182,13 +218,160 @@ void SaveImage(pstd::string_view filename, vec2i size, int nchannel, const uint8
         LOG_WARNING("& has unsupported image file extension", filename);
     }
 }
-vec3u8 *ReadLDRImage(pstd::string_view filename, vec2i & /*size*/) {
-    //int nchannel = 0;
-    uint8_t *data = nullptr;
-    LOG_WARNING("[FileIO]Sorry, but image loading is not yet supported");
-    if (!data)
+
+struct ImageWriter {
+    struct Job {
+        pstd::string filename;
+        vec2i size;
+        int nchannel = 0;
+        pstd::vector<float> data;
+    };
+
+    ~ImageWriter() {
+        Flush();
+        {
+            std::lock_guard<std::mutex> lk(mutex);
+            stop = true;
+        }
+        cv.notify_all();
+        if (thread.joinable())
+            thread.join();
+    }
+
+    void Push(Job job) {
+        std::unique_lock<std::mutex> lk(mutex);
+        if (!thread.joinable())
+            thread = std::thread([this]() { Run(); });
+        cv.wait(lk, [&]() { return count < Capacity; });
+        jobs[(head + count) % Capacity] = pstd::move(job);
+        count++;
+        cv.notify_all();
+    }
+
+    void Flush() {
+        std::unique_lock<std::mutex> lk(mutex);
+        cv.wait(lk, [&]() { return count == 0 && !busy; });
+    }
+
+  private:
+    void Run() {
+        while (true) {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lk(mutex);
+                cv.wait(lk, [&]() { return count != 0 || stop; });
+                if (count == 0)
+                    return;
+                job = pstd::move(jobs[head]);
+                head = (head + 1) % Capacity;
+                count--;
+                busy = true;
+                cv.notify_all();
+            }
+
+            pstd::vector<uint8_t> pixels(job.data.size());
+            ConvertToLDR(job.data.data(), pixels.data(), (int)pixels.size());
+            SaveImage(job.filename, job.size, job.nchannel, pixels.data());
+
+            {
+                std::lock_guard<std::mutex> lk(mutex);
+                busy = false;
+            }
+            cv.notify_all();
+        }
+    }
+
+    static constexpr int Capacity = 4;
+    Job jobs[Capacity];
+    int head = 0, count = 0;
+    bool busy = false, stop = false;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::thread thread;
+};
+
+static ImageWriter imageWriter;
+
+void SaveImageAsync(pstd::string_view filename, vec2i size, int nchannel,
+                    pstd::vector<float> data) {
+    imageWriter.Push({(pstd::string)filename, size, nchannel, pstd::move(data)});
+}
+void FlushImageWrites() {
+    imageWriter.Flush();
+}
+
+TiledImageWriter::TiledImageWriter(pstd::string_view filename, vec2i size)
+    : filename(ChangeFileExtension(filename, "bmp")), size(size) {
+    if (GetFileExtension(filename) != "bmp")
+        LOG_WARNING("[TiledImageWriter]& has unsupported extension, writing \"&\" instead",
+                    filename, this->filename);
+    if (!FitsBMP(this->filename, size))
+        return;
+    file = pstd::make_unique<ScopedFile>(this->filename, pstd::ios::out | pstd::ios::binary);
+    rowStride = BMPRowStride(size.x);
+
+    WriteBMPHeader(*file, size);
+    uint8_t zero = 0;
+    file->Seek(54 + rowStride * size.y - 1);
+    file->Write(zero);
+}
+void TiledImageWriter::WriteTile(vec2i origin, vec2i extent, const float *rgba) {
+    if (!file)
+        return;
+    pstd::vector<uint8_t> rgb(extent.x * 4), bgr(extent.x * 3);
+    for (int r = 0; r < extent.y; r++) {
+        ConvertToLDR(rgba + r * extent.x * 4, rgb.data(), extent.x * 4);
+        for (int x = 0; x < extent.x; x++) {
+            bgr[x * 3 + 0] = rgb[x * 4 + 2];
+            bgr[x * 3 + 1] = rgb[x * 4 + 1];
+            bgr[x * 3 + 2] = rgb[x * 4 + 0];
+        }
+        int y = origin.y + extent.y - 1 - r;
+        file->Seek(54 + rowStride * y + origin.x * 3);
+        file->Write(bgr.data(), bgr.size());
+    }
+}
+
+static vec3u8 *ReadImageBMP(pstd::string_view filename, vec2i &size) {
+    auto file = ReadBinaryData(filename);
+    if (file.size() < 54 || file[0] != 'B' || file[1] != 'M')
+        return nullptr;
+    auto read = [&](size_t offset, auto value) {
+        pstd::memcpy(&value, &file[offset], sizeof(value));
+        return value;
+    };
+    uint32_t offset = read(10, uint32_t());
+    size = {read(18, int32_t()), read(22, int32_t())};
+    int bytesPerPixel = read(28, uint16_t()) / 8;
+    bool topDown = size.y < 0;
+    size.y = pstd::abs(size.y);
+    size_t rowStride = (size_t(size.x) * bytesPerPixel + 3) / 4 * 4;
+    if ((bytesPerPixel != 3 && bytesPerPixel != 4) || offset + rowStride * size.y > file.size())
+        return nullptr;
+
+    vec3u8 *data = new vec3u8[Area(size)];
+    for (int y = 0; y < size.y; y++) {
+        const uint8_t *row = (const uint8_t *)&file[offset + rowStride * y];
+        vec3u8 *dst = data + (topDown ? y : size.y - 1 - y) * size.x;
+        for (int x = 0; x < size.x; x++)
+            dst[x] = {row[x * bytesPerPixel + 2], row[x * bytesPerPixel + 1],
+                      row[x * bytesPerPixel + 0]};
+    }
+    return data;
+}
+vec3u8 *ReadLDRImage(pstd::string_view filename, vec2i &size) {
+    vec3u8 *data = nullptr;
+    SWITCH(GetFileExtension(filename)) {
+        CASE("bmp") data = ReadImageBMP(filename, size);
+        DEFAULT
+        LOG_WARNING("[FileIO]& has unsupported image file extension", filename);
+    }
+    if (!data) {
         LOG_WARNING("[FileIO]Failed to load \"&\"", filename);
-    return (vec3u8 *)data;
+        size = {};
+    }
+    return data;
 }
 
 pstd::pair<pstd::vector<float>, vec3i> LoadVolume(pstd::string_view filename) {
@@ -248,9 +431,22 @@ pstd::pair<pstd::vector<float>, vec3i> LoadCompressedVolume(pstd::string_view /*
     return {};
 }
 
+static void CreateLights(const Parameters &params, Scene *scene) {
+    scene->lights.clear();
+    scene->envLight = pstd::nullopt;
+    for (auto &p : params.GetAll("Light"))
+        scene->lights.push_back(CreateLight(p));
+    for (auto &shape : scene->shapes)
+        if (auto light = shape.GetLight())
+            scene->lights.push_back(*light);
+    for (const Light &light : scene->lights)
+        if (light.Is<EnvironmentLight>())
+            scene->envLight = light.Be<EnvironmentLight>();
+}
 Parameters LoadScene(pstd::string_view filename, Scene *scene) {
     LOG("[FileIO]Loading \"&\"", filename);
 
+    sceneDirectory = "";
     Parameters params = Parse(ReadStringFile(filename));
 
     sceneDirectory = GetFileDirectory(filename);
@@ -261,17 +457,9 @@ Parameters LoadScene(pstd::string_view filename, Scene *scene) {
         scene->materials[p.GetString("name")] = pstd::make_shared<Material>(CreateMaterial(p));
     for (auto &p : params.GetAll("Medium"))
         scene->mediums[p.GetString("name")] = pstd::make_shared<Medium>(CreateMedium(p));
-    for (auto &p : params.GetAll("Light"))
-        scene->lights.push_back(CreateLight(p));
     for (auto &p : params.GetAll("Shape"))
         scene->shapes.push_back(CreateShape(p, scene));
-
-    for (auto &shape : scene->shapes)
-        if (auto light = shape.GetLight())
-            scene->lights.push_back(*light);
-    for (const Light &light : scene->lights)
-        if (light.Is<EnvironmentLight>())
-            scene->envLight = light.Be<EnvironmentLight>();
+    CreateLights(params, scene);
 
     scene->camera = CreateCamera(params["Camera"], scene);
 
@@ -279,5 +467,27 @@ Parameters LoadScene(pstd::string_view filename, Scene *scene) {
 
     return params;
 }
+void UpdateScene(Parameters &sceneParams, const Parameters &job, Scene *scene) {
+    if (job.HasSubset("Material")) {
+        for (auto &p : job.GetAll("Material")) {
+            pstd::string name = p.GetString("name");
+            if (auto material = Find(scene->materials, name))
+                **material = CreateMaterial(p);
+            else
+                scene->materials[name] = pstd::make_shared<Material>(CreateMaterial(p));
+        }
+        CreateLights(sceneParams, scene);
+    }
+
+    scene->integrator = nullptr;
+    if (job.HasSubset("Camera")) {
+        sceneParams["Camera"] = job["Camera"];
+        scene->camera = CreateCamera(sceneParams["Camera"], scene);
+    }
+    if (job.HasSubset("Integrator"))
+        sceneParams["Integrator"] = job["Integrator"];
+    scene->integrator =
+        pstd::shared_ptr<Integrator>(CreateIntegrator(sceneParams["Integrator"], scene));
+}
 
 }  // namespace pine
@@ -5,6 +5,7 @@
 #include <util/archive.h>
 
 #include <pstd/fstream.h>
+#include <pstd/memory.h>
 #include <pstd/string.h>
 #include <pstd/vector.h>
 
@@ -26,6 +27,7 @@ struct ScopedFile {
 
     void Write(const void* data, size_t size);
     void Read(void* data, size_t size);
+    void Seek(size_t pos);
 
     size_t Size() const {
         return file.size();
@@ -39,6 +41,8 @@ struct ScopedFile {
 };
 
 bool IsFileExist(pstd::string_view filename);
+// The path file functions open `filename` at, relative to the directory of the loaded scene
+pstd::string ResolveFilePath(pstd::string_view filename);
 pstd::string GetFileDirectory(pstd::string_view filename);
 pstd::string GetFileExtension(pstd::string_view filename);
 pstd::string RemoveFileExtension(pstd::string_view filename);
@@ -47,10 +51,28 @@ pstd::string AppendFileName(pstd::string_view filename, pstd::string content);
 
 pstd::string ReadStringFile(pstd::string_view filename);
 void WriteBinaryData(pstd::string_view filename, const void* ptr, size_t size);
+void RenameFile(pstd::string_view from, pstd::string_view to);
 pstd::vector<char> ReadBinaryData(pstd::string_view filename);
 
 void SaveImage(pstd::string_view filename, vec2i size, int nchannel, const float* data);
 void SaveImage(pstd::string_view filename, vec2i size, int nchannel, const uint8_t* data);
+void SaveImageAsync(pstd::string_view filename, vec2i size, int nchannel,
+                    pstd::vector<float> data);
+void FlushImageWrites();
+
+// Writes an image tile by tile into a preallocated file without holding the full image in memory;
+// the output is always a BMP, and nothing is written for images past the BMP size limit
+struct TiledImageWriter {
+    TiledImageWriter(pstd::string_view filename, vec2i size);
+
+    // `rgba` is laid out like Film's pixel buffer, with rows stored top to bottom
+    void WriteTile(vec2i origin, vec2i extent, const float* rgba);
+
+    pstd::string filename;
+    pstd::unique_ptr<ScopedFile> file;
+    vec2i size;
+    size_t rowStride = 0;
+};
 vec3u8* ReadLDRImage(pstd::string_view filename, vec2i& size);
 
 pstd::pair<pstd::vector<float>, vec3i> LoadVolume(pstd::string_view filename);
@@ -58,6 +80,9 @@ void CompressVolume(pstd::string_view filename, const pstd::vector<float>& densi
 pstd::pair<pstd::vector<float>, vec3i> LoadCompressedVolume(pstd::string_view filename);
 
 Parameters LoadScene(pstd::string_view filename, Scene* scene);
+// Applies the Camera, Integrator and Material blocks of `job` to a loaded scene; shapes and
+// the acceleration structure are kept
+void UpdateScene(Parameters& sceneParams, const Parameters& job, Scene* scene);
 
 template <typename... Ts>
 void Serialize(pstd::string_view filename, const Ts&... object) {
@@ -26,6 +26,8 @@ void Append(pstd::vector<T>& a, const pstd::vector<T>& b) {
 
 template <typename T>
 struct HuffmanTree {
+    PSTD_ARCHIVE(encoder)
+
     mutable pstd::map<T, uint32_t> encoder;
 };
 
@@ -85,6 +87,8 @@ auto BuildHuffmanTree(const Input& input) {
 }
 
 struct HuffmanEncoded {
+    PSTD_ARCHIVE(data, nbits, nElements)
+
     pstd::vector<uint8_t> data;
     uint32_t nbits = 0;
     size_t nElements = 0;
@@ -0,0 +1,118 @@
+#include <util/imagemetrics.h>
+#include <util/parallel.h>
+#include <util/fileio.h>
+#include <util/profiler.h>
+
+namespace pine {
+
+// Planar channels keep the per-row loops below free of gathers so they vectorize
+struct PlanarImage {
+    PlanarImage(const vec3* image, vec2i size) : size(size) {
+        int nPixels = Area(size);
+        for (int c = 0; c < 3; c++)
+            channels[c].resize(nPixels);
+        luminance.resize(nPixels);
+        ParallelFor(size.y, [&](int y) {
+            for (int i = y * size.x; i < (y + 1) * size.x; i++) {
+                for (int c = 0; c < 3; c++)
+                    channels[c][i] = image[i][c];
+                luminance[i] = 0.212671f * image[i][0] + 0.715160f * image[i][1] +
+                               0.072169f * image[i][2];
+            }
+        });
+    }
+
+    vec2i size;
+    pstd::vector<float> channels[3];
+    pstd::vector<float> luminance;
+};
+
+static double SSIM(const PlanarImage& x, const PlanarImage& y) {
+    constexpr int window = 8, stride = 4;
+    constexpr float c1 = 0.01f * 0.01f, c2 = 0.03f * 0.03f;
+    vec2i nWindows = Max((x.size - vec2i(window)) / stride + vec2i(1), vec2i(0));
+    if (Area(nWindows) == 0)
+        return 1.0;
+
+    pstd::vector<double> sums(NumThreads());
+    ParallelFor(nWindows.y, [&](int wy) {
+        for (int wx = 0; wx < nWindows.x; wx++) {
+            float mx = 0.0f, my = 0.0f, mxx = 0.0f, myy = 0.0f, mxy = 0.0f;
+            for (int dy = 0; dy < window; dy++) {
+                int row = (wy * stride + dy) * x.size.x + wx * stride;
+                const float* px = &x.luminance[row];
+                const float* py = &y.luminance[row];
+                for (int dx = 0; dx < window; dx++) {
+                    mx += px[dx];
+                    my += py[dx];
+                    mxx += px[dx] * px[dx];
+                    myy += py[dx] * py[dx];
+                    mxy += px[dx] * py[dx];
+                }
+            }
+            float n = window * window;
+            mx /= n;
+            my /= n;
+            float vx = mxx / n - mx * mx, vy = myy / n - my * my, cxy = mxy / n - mx * my;
+            sums[threadIdx] += ((2 * mx * my + c1) * (2 * cxy + c2)) /
+                               ((mx * mx + my * my + c1) * (vx + vy + c2));
+        }
+    });
+
+    double sum = 0.0;
+    for (double s : sums)
+        sum += s;
+    return sum / Area(nWindows);
+}
+
+ImageError CompareImages(const vec3* image, const vec3* reference, vec2i size) {
+    Profiler _("CompareImages");
+    PlanarImage x(image, size), y(reference, size);
+
+    pstd::vector<double> squaredErrors(NumThreads()), relativeErrors(NumThreads());
+    ParallelFor(size.y, [&](int row) {
+        float se = 0.0f, re = 0.0f;
+        for (int c = 0; c < 3; c++) {
+            const float* px = &x.channels[c][row * size.x];
+            const float* py = &y.channels[c][row * size.x];
+            for (int i = 0; i < size.x; i++) {
+                float d = px[i] - py[i];
+                se += d * d;
+                re += d * d / (py[i] * py[i] + 0.01f);
+            }
+        }
+        squaredErrors[threadIdx] += se;
+        relativeErrors[threadIdx] += re;
+    });
+
+    ImageError error;
+    for (int i = 0; i < NumThreads(); i++) {
+        error.mse += squaredErrors[i];
+        error.relMSE += relativeErrors[i];
+    }
+    error.mse /= 3.0 * Area(size);
+    error.relMSE /= 3.0 * Area(size);
+    error.ssim = SSIM(x, y);
+    return error;
+}
+
+pstd::optional<ImageError> CompareImages(pstd::string_view image, pstd::string_view reference) {
+    vec2i size, referenceSize;
+    pstd::unique_ptr<vec3u8[]> x(ReadLDRImage(image, size));
+    pstd::unique_ptr<vec3u8[]> y(ReadLDRImage(reference, referenceSize));
+    if (!x || !y)
+        return pstd::nullopt;
+    if (size != referenceSize) {
+        LOG_WARNING("[CompareImages]\"&\" has size &, expect &", image, size, referenceSize);
+        return pstd::nullopt;
+    }
+
+    pstd::vector<vec3> fx(Area(size)), fy(Area(size));
+    for (int i = 0; i < Area(size); i++) {
+        fx[i] = x[i] / 255.0f;
+        fy[i] = y[i] / 255.0f;
+    }
+    return CompareImages(fx.data(), fy.data(), size);
+}
+
+}  // namespace pine
@@ -0,0 +1,24 @@
+#ifndef PINE_UTIL_IMAGEMETRICS_H
+#define PINE_UTIL_IMAGEMETRICS_H
+
+#include <core/vecmath.h>
+
+#include <pstd/optional.h>
+#include <pstd/string.h>
+
+namespace pine {
+
+struct ImageError {
+    double mse = 0.0;
+    double relMSE = 0.0;
+    double ssim = 1.0;
+};
+
+// Images are RGB in [0, 1]; relMSE divides each squared error by the squared reference value
+// plus 0.01, SSIM is computed on luminance over 8x8 windows with a stride of 4
+ImageError CompareImages(const vec3* image, const vec3* reference, vec2i size);
+pstd::optional<ImageError> CompareImages(pstd::string_view image, pstd::string_view reference);
+
+}  // namespace pine
+
+#endif  // PINE_UTIL_IMAGEMETRICS_H
@@ -1,4 +1,5 @@
 #include <util/log.h>
+#include <util/profiler.h>
 
 #include <pstd/math.h>
 
@@ -16,6 +17,7 @@ double Timer::Reset() {
 }
 
 void ProgressReporter::Report(int64_t current) {
+    Telemetry::SetProgress(current, total);
     static std::mutex mutex;
     if (current < previous)
         return;
@@ -27,10 +29,13 @@ void ProgressReporter::Report(int64_t current) {
         LOG_SAMELINE("[&]&[0/&]  Progress[0%]  ETA[?] ?M &/s", tag, desc, Format(nDigit), total,
                      performance);
     } else {
+        double rate = (current - previous) * multiplier / (interval.Reset() * 1000.0f);
         LOG_SAMELINE("[&]&[&/&]  Progress[&2.1%]  ETA[&.0s] &3.3M &/s", tag, desc, Format(nDigit),
                      current, Format(nDigit), total, 100.0 * current / total,
-                     pstd::ceil((total - current) * ETA.ElapsedMs() / (1000.0 * current)),
-                     (current - previous) * multiplier / (interval.Reset() * 1000.0f), performance);
+                     pstd::ceil((total - current) * ETA.ElapsedMs() / (1000.0 * current)), rate,
+                     performance);
+        if (Trace::Enabled())
+            Trace::AddCounter(tag + " " + desc, "M " + performance + "/s", rate);
     }
     if (current == total)
         LOG_SAMELINE("[&]Average:&4.4M &/s\n", tag, total * multiplier / (ETA.ElapsedMs() * 1000.0),
@@ -4,19 +4,15 @@
 #include <util/profiler.h>
 
 #include <util/fileio.h>
+#include <util/assetcache.h>
 
 #include <pstd/algorithm.h>
 
 namespace pine {
 
-TriangleMesh LoadObj(pstd::string_view filename) {
-    Profiler _("LoadObj");
-    LOG_PLAIN("[FileIO]Loading \"&\"", filename);
-    Timer timer;
-
-    TriangleMesh mesh;
-    pstd::string raw = ReadStringFile(filename);
-    pstd::string_view str = raw;
+static TriangleMesh ParseObj(pstd::string_view str) {
+    pstd::vector<vec3> vertices;
+    pstd::vector<uint32_t> indices;
 
     pstd::string face;
     face.reserve(64);
@@ -29,7 +25,7 @@ TriangleMesh LoadObj(pstd::string_view filename) {
         if (line[0] == 'v' && line[1] != 't' && line[1] != 'n') {
             vec3 v;
             pstd::stofs((pstd::string)trim(line, 2), &v[0], 3);
-            mesh.vertices.push_back(v);
+            vertices.push_back(v);
 
         } else if (line[0] == 'f') {
             line = trim(line, 2);
@@ -63,41 +59,55 @@ TriangleMesh LoadObj(pstd::string_view filename) {
                 pstd::stois(face, &f[0], 3);
                 for (int i = 0; i < 3; i++) {
                     if (f[i] < 0)
-                        f[i] = mesh.vertices.size() + f[i];
+                        f[i] = vertices.size() + f[i];
                     else
                         f[i] -= 1;
                 }
-                mesh.indices.push_back(f.x);
-                mesh.indices.push_back(f.y);
-                mesh.indices.push_back(f.z);
+                indices.push_back(f.x);
+                indices.push_back(f.y);
+                indices.push_back(f.z);
             } else if (spaceCount == 3) {
                 vec4i f;
                 pstd::stois(face.c_str(), &f[0], 4);
                 for (int i = 0; i < 4; i++) {
                     if (f[i] < 0)
-                        f[i] = mesh.vertices.size() + f[i];
+                        f[i] = vertices.size() + f[i];
                     else
                         f[i] -= 1;
                 }
-                mesh.indices.push_back(f[0]);
-                mesh.indices.push_back(f[1]);
-                mesh.indices.push_back(f[2]);
-                mesh.indices.push_back(f[0]);
-                mesh.indices.push_back(f[2]);
-                mesh.indices.push_back(f[3]);
+                indices.push_back(f[0]);
+                indices.push_back(f[1]);
+                indices.push_back(f[2]);
+                indices.push_back(f[0]);
+                indices.push_back(f[2]);
+                indices.push_back(f[3]);
             }
         }
         face.clear();
         str = trim(str, pos + 1);
     }
     uint32_t minIndices = -1;
-    for (auto &i : mesh.indices)
+    for (auto &i : indices)
         minIndices = pstd::min(minIndices, i);
-    for (auto &i : mesh.indices)
+    for (auto &i : indices)
         i -= minIndices;
 
-    LOG_PLAIN(", &M triangles, &ms\n", mesh.indices.size() / 3 / 1000000.0, timer.Reset());
-    return mesh;
+    return TriangleMesh(pstd::make_shared<pstd::vector<vec3>>(pstd::move(vertices)),
+                        pstd::make_shared<pstd::vector<uint32_t>>(pstd::move(indices)));
+}
+
+TriangleMesh LoadObj(pstd::string_view filename) {
+    Profiler _("LoadObj");
+    LOG_PLAIN("[FileIO]Loading \"&\"", filename);
+    Timer timer;
+
+    pstd::string raw = ReadStringFile(filename);
+    auto mesh = AssetCache::FindOrCreate<TriangleMesh>(HashBuffer(raw.data(), raw.size()),
+                                                       [&]() { return ParseObj(raw); });
+
+    LOG_PLAIN(", &M triangles, &ms\n", mesh->GetNumTriangles() / 1000000.0, timer.Reset());
+    // Copies only share the vertex and index storage
+    return *mesh;
 }
 
 }  // namespace pine
\ No newline at end of file
@@ -15,6 +15,8 @@ inline int NumThreads() {
 }
 
 thread_local inline int threadIdx;
+// Distinguishes worker 0 from threads outside of ParallelFor, whose threadIdx is also 0
+thread_local inline bool isWorkerThread;
 
 template <typename F, typename... Args>
 void ParallelForImpl(int64_t nItems, F&& f) {
@@ -26,6 +28,7 @@ void ParallelForImpl(int64_t nItems, F&& f) {
     for (auto& thread : threads)
         thread = std::thread([&, tid = tid++]() {
             threadIdx = tid;
+            isWorkerThread = true;
             while (true) {
                 int64_t workId = i += batchSize;
                 workId -= batchSize;
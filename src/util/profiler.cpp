@@ -1,21 +1,35 @@
 #include <util/profiler.h>
+#include <util/parallel.h>
 
 #include <pstd/map.h>
 #include <pstd/vector.h>
 #include <pstd/memory.h>
+#include <pstd/fstream.h>
 
+#include <condition_variable>
+#include <thread>
 #include <mutex>
 #include <atomic>
 
+#include <stdio.h>
+
 #include <signal.h>
 #include <sys/time.h>
 
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 namespace pine {
 
 static pstd::shared_ptr<Profiler::Record> profilerRecord = pstd::make_shared<Profiler::Record>();
 
 void Profiler::Finalize() {
     main.reset();
+    Trace::Write();
     LOG("[Profiler]Results:");
 
     LOG("#structured:");
@@ -77,6 +91,8 @@ void Profiler::Finalize() {
     LOG("\n");
 }
 Profiler::Profiler(pstd::string description) {
+    if (Trace::Enabled())
+        start = Trace::Now();
     pstd::shared_ptr<Record>& rec = profilerRecord->children[description];
     if (rec == nullptr)
         rec = pstd::make_shared<Record>();
@@ -88,24 +104,98 @@ Profiler::Profiler(pstd::string description) {
 Profiler::~Profiler() {
     pstd::shared_ptr<Record> rec = profilerRecord;
 
-    rec->time += timer.ElapsedMs();
+    double elapsed = timer.ElapsedMs();
+    rec->time += elapsed;
     rec->sampleCount++;
+    if (Trace::Enabled())
+        Trace::AddRegion(rec->name, start, elapsed);
 
     profilerRecord = rec->parent;
 }
 
-static thread_local uint64_t profilePhase = {};
-static pstd::map<uint64_t, uint64_t> profilePhaseRecords = {};
-static uint64_t profileTotalSamples = 0;
+static pstd::string traceFilename;
+static Timer traceClock;
+static std::mutex traceMutex;
+static pstd::vector<pstd::string> traceEvents;
+static std::atomic<int> traceThreadCount{0};
+
+static int TraceThreadId() {
+    static thread_local int id = -1;
+    if (id == -1) {
+        id = traceThreadCount++;
+        pstd::string name = id == 0 ? pstd::string("Main") : pstd::to_string("Thread ", id);
+        traceEvents.push_back(pstd::to_string(
+            "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": ", id,
+            ", \"args\": {\"name\": \"", name, "\"}}"));
+    }
+    return id;
+}
+void Trace::Enable(pstd::string filename) {
+    traceFilename = filename;
+    traceClock.Reset();
+    enabled = true;
+}
+double Trace::Now() {
+    return traceClock.ElapsedMs();
+}
+void Trace::AddRegion(const pstd::string& name, double start, double duration) {
+    std::lock_guard<std::mutex> lk(traceMutex);
+    int tid = TraceThreadId();
+    traceEvents.push_back(pstd::to_string("{\"name\": \"", name,
+                                          "\", \"ph\": \"X\", \"pid\": 0, \"tid\": ", tid,
+                                          ", \"ts\": ", start * 1000.0,
+                                          ", \"dur\": ", duration * 1000.0, "}"));
+}
+void Trace::AddCounter(const pstd::string& name, const pstd::string& series, double value) {
+    std::lock_guard<std::mutex> lk(traceMutex);
+    traceEvents.push_back(pstd::to_string("{\"name\": \"", name,
+                                          "\", \"ph\": \"C\", \"pid\": 0, \"ts\": ",
+                                          Now() * 1000.0, ", \"args\": {\"", series,
+                                          "\": ", value, "}}"));
+}
+void Trace::Write() {
+    if (!enabled)
+        return;
+    std::lock_guard<std::mutex> lk(traceMutex);
+    pstd::string json = "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    for (size_t i = 0; i < traceEvents.size(); i++)
+        json += traceEvents[i] + (i + 1 == traceEvents.size() ? "\n" : ",\n");
+    json += "]}\n";
+    pstd::fstream file(traceFilename, pstd::ios::out | pstd::ios::binary);
+    if (!file.is_open()) {
+        LOG_WARNING("[Trace]Can not open \"&\"", traceFilename);
+        return;
+    }
+    file.write(json.data(), json.size());
+    LOG("[Trace]& events written to \"&\"", traceEvents.size(), traceFilename);
+}
+
+static constexpr int numPhaseMasks = 1 << (int)ProfilePhase::NumPhase;
+static thread_local uint32_t profilePhase = {};
+// One row of `numPhaseMasks` counters per worker thread, indexed by `threadIdx`; threads outside
+// of ParallelFor, the main thread included, share an extra last row, hence the atomic increments
+static pstd::unique_ptr<std::atomic<uint32_t>[]> profileCounters;
+static int profileThreads = 0;
 static_assert(
     (int)ProfilePhase::NumPhase == sizeof(profilePhaseName) / sizeof(profilePhaseName[0]),
     "Expect ProfilePhase::NumPhase == sizeof(profilePhaseName) / sizeof(profilePhaseName[0])");
 
+// Row of the calling thread in the per-thread counter tables of `nThreads` workers
+static int ProfileRow(int nThreads) {
+    return isWorkerThread && threadIdx < nThreads ? threadIdx : nThreads;
+}
+
 void RecordSampleCallback(int, siginfo_t*, void*) {
-    profilePhaseRecords[profilePhase]++;
-    profileTotalSamples++;
+    int thread = ProfileRow(profileThreads);
+    profileCounters[thread * numPhaseMasks + profilePhase].fetch_add(1, std::memory_order_relaxed);
 }
-void SampledProfiler::Initialize() {
+void SampledProfiler::Initialize(int frequency) {
+    if (frequency <= 0)
+        return;
+    profileThreads = NumThreads();
+    profileCounters = pstd::unique_ptr<std::atomic<uint32_t>[]>(
+        new std::atomic<uint32_t>[(profileThreads + 1) * numPhaseMasks]());
+
     struct sigaction sa;
     pstd::memset(&sa, 0, sizeof(sa));
     sa.sa_sigaction = RecordSampleCallback;
@@ -115,36 +205,45 @@ void SampledProfiler::Initialize() {
 
     static struct itimerval timer;
     timer.it_interval.tv_sec = 0;
-    timer.it_interval.tv_usec = 1000000 / 100;
+    timer.it_interval.tv_usec = pstd::max(1000000 / frequency, 1);
     timer.it_value = timer.it_interval;
 
     CHECK_EQ(setitimer(ITIMER_PROF, &timer, NULL), 0);
 }
-void SampledProfiler::Finalize() {
-    static struct itimerval timer;
-    timer.it_interval.tv_sec = 0;
-    timer.it_interval.tv_usec = 0;
-    timer.it_value = timer.it_interval;
-    CHECK_EQ(setitimer(ITIMER_PROF, &timer, NULL), 0);
-    LOG("[SampledProfiler]Results:");
-
+// Returns the samples of each phase and the total number of samples of the given threads
+static pstd::pair<pstd::vector<pstd::pair<pstd::string, uint64_t>>, uint64_t> MergePhaseCounters(
+    int firstThread, int lastThread) {
     pstd::vector<pstd::pair<pstd::string, uint64_t>> phaseStat((int)ProfilePhase::NumPhase);
     for (int i = 0; i < (int)ProfilePhase::NumPhase; i++)
         phaseStat[i].first = profilePhaseName[i];
 
-    for (auto record : profilePhaseRecords) {
-        for (int b = 0; b < (int)ProfilePhase::NumPhase; b++) {
-            if (uint64_t(1) & (record.first >> b)) {
-                phaseStat[b].second += record.second;
-            }
+    uint64_t totalSamples = 0;
+    for (int t = firstThread; t < lastThread; t++)
+        for (int mask = 0; mask < numPhaseMasks; mask++) {
+            uint64_t count = profileCounters[t * numPhaseMasks + mask];
+            totalSamples += count;
+            for (int b = 0; b < (int)ProfilePhase::NumPhase; b++)
+                if ((mask >> b) & 1)
+                    phaseStat[b].second += count;
         }
-    }
 
     pstd::sort(phaseStat,
                [](pstd::pair<pstd::string, uint64_t> lhs, pstd::pair<pstd::string, uint64_t> rhs) {
                    return lhs.second > rhs.second;
                });
+    return {phaseStat, totalSamples};
+}
+void SampledProfiler::Finalize() {
+    if (!profileCounters)
+        return;
+    static struct itimerval timer;
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = 0;
+    timer.it_value = timer.it_interval;
+    CHECK_EQ(setitimer(ITIMER_PROF, &timer, NULL), 0);
+    LOG("[SampledProfiler]Results:");
 
+    auto [phaseStat, totalSamples] = MergePhaseCounters(0, profileThreads + 1);
     size_t maxWidth = 0;
     for (auto pair : phaseStat) {
         maxWidth = pstd::max(pair.first.size(), maxWidth);
@@ -152,16 +251,265 @@ void SampledProfiler::Finalize() {
     for (auto pair : phaseStat) {
         if (pair.second)
             LOG("| &<: &10 &4.2%", Format(maxWidth), pair.first, pair.second,
-                100.0 * pair.second / profileTotalSamples);
+                100.0 * pair.second / totalSamples);
+    }
+
+    LOG("\n#per-thread:");
+    for (int t = 0; t <= profileThreads; t++) {
+        auto [threadStat, threadSamples] = MergePhaseCounters(t, t + 1);
+        if (threadSamples == 0)
+            continue;
+        pstd::string top;
+        for (int i = 0; i < 3 && threadStat[i].second; i++)
+            top += FormatIt("  &: &2.1%", threadStat[i].first,
+                            100.0 * threadStat[i].second / threadSamples);
+        pstd::string name = t == profileThreads ? "Main" : FormatIt("Thread &3", t);
+        LOG("| &<: &10 samples&", Format(10), name, threadSamples, top);
     }
 
     LOG("");
 }
 SampledProfiler::SampledProfiler(ProfilePhase p) : p(p) {
+    outermost = !(profilePhase & (uint64_t(1) << (int)p));
     profilePhase |= uint64_t(1) << (int)p;
+    if (PhaseCounters::enabled && outermost)
+        PhaseCounters::Begin(p);
 }
 SampledProfiler::~SampledProfiler() {
+    if (!outermost)
+        return;
+    if (PhaseCounters::enabled)
+        PhaseCounters::End(p);
     profilePhase &= ~(uint64_t(1) << (int)p);
 }
 
-}  // namespace pine
\ No newline at end of file
+enum PhaseCounter { Cycles, Instructions, CacheMisses, BranchMisses, NumCounters };
+static constexpr int numPhases = (int)ProfilePhase::NumPhase;
+// `numPhases * NumCounters` totals per worker thread, indexed like `profileCounters`
+static pstd::unique_ptr<std::atomic<uint64_t>[]> phaseCounterTotals;
+static int phaseCounterThreads = 0;
+
+#ifdef __linux__
+// Counters of the calling thread, opened as one group on first use so they are read together;
+// ParallelFor starts new threads on each call so they are closed when the thread exits
+struct ThreadCounters {
+    ThreadCounters() {
+        const uint64_t configs[NumCounters] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                               PERF_COUNT_HW_CACHE_MISSES,
+                                               PERF_COUNT_HW_BRANCH_MISSES};
+        for (int i = 0; i < NumCounters; i++) {
+            perf_event_attr attr;
+            pstd::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = configs[i];
+            attr.read_format = PERF_FORMAT_GROUP;
+            attr.disabled = i == 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, i == 0 ? -1 : fds[0], 0);
+            if (fds[i] < 0)
+                return;
+        }
+        ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        valid = true;
+    }
+    ~ThreadCounters() {
+        for (int fd : fds)
+            if (fd >= 0)
+                close(fd);
+    }
+
+    bool Read(uint64_t values[NumCounters]) const {
+        struct {
+            uint64_t nr;
+            uint64_t values[NumCounters];
+        } group;
+        if (!valid || read(fds[0], &group, sizeof(group)) != sizeof(group))
+            return false;
+        pstd::memcpy(values, group.values, sizeof(group.values));
+        return true;
+    }
+
+    int fds[NumCounters] = {-1, -1, -1, -1};
+    bool valid = false;
+};
+static ThreadCounters& LocalCounters() {
+    static thread_local ThreadCounters counters;
+    return counters;
+}
+static thread_local uint64_t phaseCounterStart[numPhases][NumCounters];
+
+void PhaseCounters::Initialize() {
+    ThreadCounters counters;
+    if (!counters.valid) {
+        LOG_WARNING("[PhaseCounters]perf_event_open failed, check kernel.perf_event_paranoid");
+        return;
+    }
+    phaseCounterThreads = NumThreads();
+    phaseCounterTotals = pstd::unique_ptr<std::atomic<uint64_t>[]>(
+        new std::atomic<uint64_t>[(phaseCounterThreads + 1) * numPhases * NumCounters]());
+    enabled = true;
+}
+void PhaseCounters::Begin(ProfilePhase phase) {
+    LocalCounters().Read(phaseCounterStart[(int)phase]);
+}
+void PhaseCounters::End(ProfilePhase phase) {
+    uint64_t values[NumCounters];
+    if (!LocalCounters().Read(values))
+        return;
+    int thread = ProfileRow(phaseCounterThreads);
+    std::atomic<uint64_t>* totals =
+        &phaseCounterTotals[(thread * numPhases + (int)phase) * NumCounters];
+    const uint64_t* start = phaseCounterStart[(int)phase];
+    for (int i = 0; i < NumCounters; i++)
+        totals[i].fetch_add(values[i] - start[i], std::memory_order_relaxed);
+}
+#else
+void PhaseCounters::Initialize() {
+    LOG_WARNING("[PhaseCounters]Hardware counters are only supported on Linux");
+}
+void PhaseCounters::Begin(ProfilePhase) {
+}
+void PhaseCounters::End(ProfilePhase) {
+}
+#endif
+
+void PhaseCounters::Finalize() {
+    if (!enabled)
+        return;
+    enabled = false;
+    LOG("[PhaseCounters]Results:");
+    LOG("| &<  &14  &6  &11  &11", Format(20), "Phase", "Cycles", "IPC", "Cache MPKI",
+        "Branch MPKI");
+    for (int p = 0; p < numPhases; p++) {
+        uint64_t sum[NumCounters] = {};
+        for (int t = 0; t <= phaseCounterThreads; t++)
+            for (int i = 0; i < NumCounters; i++)
+                sum[i] += phaseCounterTotals[(t * numPhases + p) * NumCounters + i];
+        if (sum[Cycles] == 0)
+            continue;
+        double kiloInstructions = pstd::max(sum[Instructions], uint64_t(1)) / 1000.0;
+        LOG("| &<  &14  &3.2  &8.2  &8.2", Format(20), profilePhaseName[p], sum[Cycles],
+            double(sum[Instructions]) / sum[Cycles], sum[CacheMisses] / kiloInstructions,
+            sum[BranchMisses] / kiloInstructions);
+    }
+    LOG("");
+}
+
+static_assert((int)TelemetryCounter::NumCounter ==
+                  sizeof(telemetryCounterName) / sizeof(telemetryCounterName[0]),
+              "Expect TelemetryCounter::NumCounter == size of telemetryCounterName");
+using TelemetryTotals = pstd::vector<uint64_t>;
+
+static std::atomic<int64_t> telemetryProgress{0}, telemetryTotal{0};
+static FILE* telemetryFeed = nullptr;
+static std::thread telemetryThread;
+static std::mutex telemetryMutex;
+static std::condition_variable telemetryStop;
+static bool telemetryStopped = false;
+static Timer telemetryClock;
+
+static TelemetryTotals TelemetrySum(const pstd::unique_ptr<Telemetry::Row[]>& rows) {
+    TelemetryTotals totals((int)TelemetryCounter::NumCounter);
+    for (int t = 0; t < NumThreads(); t++)
+        for (int i = 0; i < (int)TelemetryCounter::NumCounter; i++)
+            totals[i] += rows[t].counts[i].load(std::memory_order_relaxed);
+    return totals;
+}
+// Traced rays are the ones that reach the acceleration structure
+static uint64_t TracedRays(const TelemetryTotals& totals) {
+    return totals[(int)TelemetryCounter::ClosestRays] + totals[(int)TelemetryCounter::ShadowRays];
+}
+static void WriteTelemetry(const TelemetryTotals& totals, const TelemetryTotals& previous,
+                           double seconds, double interval) {
+    int64_t total = telemetryTotal.load(std::memory_order_relaxed);
+    double progress =
+        total ? double(telemetryProgress.load(std::memory_order_relaxed)) / total : 0.0;
+    pstd::string line = pstd::to_string("{\"time\": ", seconds, ", \"progress\": ", progress);
+    for (int i = 0; i < (int)TelemetryCounter::NumCounter; i++)
+        line += pstd::to_string(", \"", telemetryCounterName[i], "\": ", totals[i]);
+    interval = pstd::max(interval, 1e-6);
+    line += pstd::to_string(
+        ", \"mraysPerSecond\": ", (TracedRays(totals) - TracedRays(previous)) / (interval * 1e6),
+        ", \"samplesPerSecond\": ",
+        (totals[(int)TelemetryCounter::Samples] - previous[(int)TelemetryCounter::Samples]) /
+            interval,
+        "}\n");
+    fputs(line.c_str(), telemetryFeed);
+    fflush(telemetryFeed);
+}
+
+void Telemetry::SetProgress(int64_t current, int64_t total) {
+    telemetryProgress.store(current, std::memory_order_relaxed);
+    telemetryTotal.store(total, std::memory_order_relaxed);
+}
+void Telemetry::StartFeed(pstd::string destination, float interval) {
+    int fd = -1;
+    if (sscanf(destination.c_str(), "fd:%d", &fd) == 1) {
+#if defined(__unix__) || defined(__APPLE__)
+        telemetryFeed = fdopen(fd, "w");
+#endif
+    } else {
+        telemetryFeed = fopen(destination.c_str(), "w");
+    }
+    if (!telemetryFeed) {
+        LOG_WARNING("[Telemetry]Can not open progress feed \"&\"", destination);
+        return;
+    }
+
+    telemetryClock.Reset();
+    telemetryThread = std::thread([interval]() {
+        TelemetryTotals previous((int)TelemetryCounter::NumCounter);
+        double previousTime = 0.0;
+        std::unique_lock<std::mutex> lk(telemetryMutex);
+        // The last line is written once stopped so readers always see the final totals
+        for (bool stopped = false; !stopped;) {
+            stopped = telemetryStop.wait_for(lk, std::chrono::duration<float>(interval),
+                                             [] { return telemetryStopped; });
+            TelemetryTotals totals = TelemetrySum(rows);
+            double time = telemetryClock.ElapsedMs() / 1000.0;
+            WriteTelemetry(totals, previous, time, time - previousTime);
+            previous = totals;
+            previousTime = time;
+        }
+    });
+}
+// Sums the time of every record named `name` under `record`
+static double RecordTime(const Profiler::Record& record, const pstd::string& name) {
+    if (record.name == name)
+        return record.time;
+    double time = 0.0;
+    for (auto& child : record.children)
+        time += RecordTime(*child.second, name);
+    return time;
+}
+void Telemetry::Finalize() {
+    if (telemetryThread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lk(telemetryMutex);
+            telemetryStopped = true;
+        }
+        telemetryStop.notify_one();
+        telemetryThread.join();
+        fclose(telemetryFeed);
+    }
+
+    TelemetryTotals totals = TelemetrySum(rows);
+    if (TracedRays(totals) == 0)
+        return;
+    // Rates are over the time spent in Profiler "Rendering" scopes, excluding loading and output
+    double seconds = RecordTime(*profilerRecord, "Rendering") / 1000.0;
+    if (seconds == 0.0 && Profiler::main)
+        seconds = Profiler::main->timer.ElapsedMs() / 1000.0;
+    seconds = pstd::max(seconds, 1e-6);
+    LOG("[Telemetry]Results:");
+    for (int i = 0; i < (int)TelemetryCounter::NumCounter; i++)
+        LOG("| &<: &14  &10.3 M/s", Format(12), telemetryCounterName[i], totals[i],
+            totals[i] / (seconds * 1e6));
+    LOG("| &<: &14  &10.3 M/s", Format(12), "tracedRays", TracedRays(totals),
+        TracedRays(totals) / (seconds * 1e6));
+    LOG("| Rendering   : &.2 s\n", seconds);
+}
+
+}  // namespace pine
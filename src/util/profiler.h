@@ -2,10 +2,19 @@
 #define PINE_UTIL_PROFILER_H
 
 #include <util/log.h>
+#include <util/parallel.h>
 
 #include <pstd/map.h>
 #include <pstd/memory.h>
 
+#include <chrono>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
 namespace pine {
 
 struct Profiler {
@@ -32,10 +41,41 @@ struct Profiler {
     };
 
     Timer timer;
+    double start = 0.0;
 
     static inline pstd::unique_ptr<Profiler> main;
 };
 
+// Chrome trace-event output for chrome://tracing and Perfetto: every Profiler region becomes a
+// duration event on the thread that opened it and ProgressReporter adds throughput counters
+struct Trace {
+    static void Enable(pstd::string filename);
+    static bool Enabled() {
+        return enabled;
+    }
+    // Milliseconds since the trace was enabled
+    static double Now();
+    static void AddRegion(const pstd::string& name, double start, double duration);
+    static void AddCounter(const pstd::string& name, const pstd::string& series, double value);
+    static void Write();
+
+  private:
+    static inline bool enabled = false;
+};
+
+// Reads the cheapest monotonic counter of the platform, only meaningful for relative costs
+inline uint64_t CycleCount() {
+#if defined(_M_X64) || defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t count;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(count));
+    return count;
+#else
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
 enum class ProfilePhase {
     GenerateRay,
     ShapeIntersect,
@@ -60,14 +100,61 @@ inline const char* profilePhaseName[] = {
     "EstimateLi",      "MediumTr",       "MediumSample",         "SearchNeighbors",
     "GenerateSamples", "FilmAddSample",  "SampleEnvLight"};
 
+// Samples the active phases of the interrupted thread `frequency` times per second of CPU time;
+// the SIGPROF handler only increments a per-thread counter indexed by the phase bitmask, so it
+// does not allocate or lock and is cheap enough to leave on
 struct SampledProfiler {
-    static void Initialize();
+    static void Initialize(int frequency = 100);
     static void Finalize();
 
     SampledProfiler(ProfilePhase phase);
     ~SampledProfiler();
 
     ProfilePhase p;
+    bool outermost;
+};
+
+// Hardware counters (cycles, instructions, cache and branch misses) of each worker thread
+// accumulated over the outermost SampledProfiler scope of every phase; reading the counters costs
+// a system call per scope so they are off unless initialized, and only available on Linux
+struct PhaseCounters {
+    static void Initialize();
+    static void Finalize();
+
+    static void Begin(ProfilePhase phase);
+    static void End(ProfilePhase phase);
+
+    static inline bool enabled = false;
+};
+
+enum class TelemetryCounter {
+    CameraRays,
+    ClosestRays,
+    ShadowRays,
+    MediumRays,
+    Samples,
+    NumCounter
+};
+inline const char* telemetryCounterName[] = {"cameraRays", "closestRays", "shadowRays",
+                                             "mediumRays", "samples"};
+
+// Throughput counters that are always on: every worker thread increments its own cache line, so
+// counting is a plain add; `StartFeed` writes the totals and the rates of the last interval as
+// one JSON object per line to a file or an inherited file descriptor ("fd:3") for schedulers
+struct Telemetry {
+    static void Count(TelemetryCounter counter, uint64_t n = 1) {
+        std::atomic<uint64_t>& count = rows[threadIdx].counts[(int)counter];
+        count.store(count.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    static void SetProgress(int64_t current, int64_t total);
+
+    static void StartFeed(pstd::string destination, float interval = 1.0f);
+    static void Finalize();
+
+    struct alignas(64) Row {
+        std::atomic<uint64_t> counts[(int)TelemetryCounter::NumCounter];
+    };
+    static inline pstd::unique_ptr<Row[]> rows{new Row[NumThreads()]()};
 };
 
 }  // namespace pine
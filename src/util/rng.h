@@ -101,6 +101,8 @@ struct RNG {
         return {Uniformf(), Uniformf(), Uniformf()};
     }
 
+    PSTD_ARCHIVE(s)
+
     uint64_t s[2];
 };
 
@@ -0,0 +1,414 @@
+#include <core/scene.h>
+#include <core/sampler.h>
+#include <core/noise.h>
+#include <core/film.h>
+#include <core/accel.h>
+#include <core/sampling.h>
+#include <util/fileio.h>
+#include <util/parser.h>
+#include <util/parameters.h>
+#include <util/rng.h>
+#include <util/log.h>
+
+using namespace pine;
+
+struct BenchResult {
+    pstd::string name;
+    pstd::string unit;
+    double value;
+    int64_t iterations;
+};
+
+static pstd::vector<BenchResult> results;
+static pstd::string filter;
+static volatile float sink;
+
+static bool Selected(const pstd::string& name) {
+    return filter.size() == 0 ||
+           (name.size() >= filter.size() && pstd::trim(name, 0, filter.size()) == filter);
+}
+
+// Doubles the iteration count until a run takes at least 50 ms, then reports the fastest of
+// five runs; every benchmark uses fixed seeds so the measured work is identical between runs
+template <typename F>
+static void Bench(pstd::string name, F&& f) {
+    if (!Selected(name))
+        return;
+    int64_t n = 1;
+    while (true) {
+        Timer timer;
+        f(n);
+        if (timer.ElapsedMs() > 50.0 || n > (int64_t(1) << 40))
+            break;
+        n *= 2;
+    }
+    double best = Infinity;
+    for (int i = 0; i < 5; i++) {
+        Timer timer;
+        f(n);
+        best = pstd::min(best, timer.ElapsedMs());
+    }
+    double ns = best * 1e6 / n;
+    LOG("[Bench]& & ns/op", name, ns);
+    results.push_back({name, "ns/op", ns, n});
+}
+
+static pstd::vector<Triangle> RandomTriangles(int count) {
+    RNG rng(1);
+    pstd::vector<Triangle> triangles(count);
+    for (auto& t : triangles) {
+        vec3 c = 4.0f * (vec3(rng.Uniformf(), rng.Uniformf(), rng.Uniformf()) - vec3(0.5f));
+        t = Triangle(c + 0.2f * vec3(rng.Uniformf(), rng.Uniformf(), rng.Uniformf()),
+                     c + 0.2f * vec3(rng.Uniformf(), rng.Uniformf(), rng.Uniformf()),
+                     c + 0.2f * vec3(rng.Uniformf(), rng.Uniformf(), rng.Uniformf()));
+    }
+    return triangles;
+}
+static pstd::vector<Ray> RandomRays(int count) {
+    RNG rng(2);
+    pstd::vector<Ray> rays(count);
+    for (auto& ray : rays)
+        ray = Ray(3.0f * UniformSphereSampling(vec2(rng.Uniformf(), rng.Uniformf())),
+                  UniformSphereSampling(vec2(rng.Uniformf(), rng.Uniformf())));
+    return rays;
+}
+
+static void GeometryBenchmarks() {
+    auto triangles = RandomTriangles(1024);
+    auto rays = RandomRays(1024);
+
+    Bench("Triangle.Hit", [&](int64_t n) {
+        int hits = 0;
+        for (int64_t i = 0; i < n; i++)
+            hits += triangles[i & 1023].Hit(rays[(i >> 10) & 1023]);
+        sink = hits;
+    });
+    Bench("Triangle.Intersect", [&](int64_t n) {
+        float t = 0.0f;
+        for (int64_t i = 0; i < n; i++) {
+            Ray ray = rays[(i >> 10) & 1023];
+            Interaction it;
+            if (triangles[i & 1023].Intersect(ray, it))
+                t += ray.tmax;
+        }
+        sink = t;
+    });
+    Bench("AABB.Hit", [&](int64_t n) {
+        int hits = 0;
+        for (int64_t i = 0; i < n; i++) {
+            float tmin, tmax;
+            hits += triangles[i & 1023].GetAABB().Hit(rays[(i >> 10) & 1023], tmin, tmax);
+        }
+        sink = hits;
+    });
+
+    Scene scene;
+    pstd::vector<vec3> vertices;
+    pstd::vector<uint32_t> indices;
+    for (auto& t : RandomTriangles(4096)) {
+        for (vec3 v : {t.v0, t.v1, t.v2}) {
+            indices.push_back(vertices.size());
+            vertices.push_back(v);
+        }
+    }
+    scene.shapes.push_back(
+        TriangleMesh(pstd::make_shared<pstd::vector<vec3>>(pstd::move(vertices)),
+                     pstd::make_shared<pstd::vector<uint32_t>>(pstd::move(indices))));
+
+    Bench("BVH.Build", [&](int64_t n) {
+        for (int64_t i = 0; i < n; i++) {
+            pstd::unique_ptr<Accel> accel(CreateAccel({}));
+            accel->Initialize(&scene);
+        }
+    });
+    pstd::unique_ptr<Accel> accel(CreateAccel({}));
+    accel->Initialize(&scene);
+    Bench("BVH.Hit", [&](int64_t n) {
+        int hits = 0;
+        for (int64_t i = 0; i < n; i++)
+            hits += accel->Hit(rays[i & 1023]);
+        sink = hits;
+    });
+    Bench("BVH.Intersect", [&](int64_t n) {
+        float t = 0.0f;
+        for (int64_t i = 0; i < n; i++) {
+            Ray ray = rays[i & 1023];
+            Interaction it;
+            if (accel->Intersect(ray, it))
+                t += ray.tmax;
+        }
+        sink = t;
+    });
+}
+
+static void SamplerBenchmarks() {
+    for (pstd::string type : {"Uniform", "Stratified", "Halton", "ZeroTwoSequence", "Sobol"}) {
+        Parameters params = Parse("Sampler: " + type + "{\n" +
+                                  "samplesPerPixel: 16\n"
+                                  "xPixelSamples: 4\n"
+                                  "yPixelSamples: 4\n"
+                                  "nSampledDimensions: 16\n"
+                                  "filmSize: 64 64\n"
+                                  "}\n");
+        Sampler sampler = CreateSampler(params["Sampler"]);
+
+        Bench("Sampler." + type + ".Get1D", [&](int64_t n) {
+            float sum = 0.0f;
+            for (int64_t i = 0; i < n; i++) {
+                if (i % 16 == 0)
+                    sampler.StartPixel(vec2i(i / 256 % 64, i / 16384 % 64), i / 16 % 16);
+                sum += sampler.Get1D();
+            }
+            sink = sum;
+        });
+        Bench("Sampler." + type + ".Get2D", [&](int64_t n) {
+            float sum = 0.0f;
+            for (int64_t i = 0; i < n; i++) {
+                if (i % 8 == 0)
+                    sampler.StartPixel(vec2i(i / 128 % 64, i / 8192 % 64), i / 8 % 16);
+                sum += sampler.Get2D().x;
+            }
+            sink = sum;
+        });
+        // One sample per pass as progressive renders take them, running past samplesPerPixel
+        Bench("Sampler." + type + ".StartPixel", [&](int64_t n) {
+            float sum = 0.0f;
+            for (int64_t i = 0; i < n; i++) {
+                sampler.StartPixel(vec2i(i % 64, i / 64 % 64), i / 4096 % 1024);
+                sum += sampler.Get2D().x;
+            }
+            sink = sum;
+        });
+    }
+}
+
+static void FilmBenchmarks() {
+    Film film = CreateFilm(Parse("film {\nsize: 256 256\noutputFileName: bench.bmp\n}\n")["film"]);
+    RNG rng(3);
+    pstd::vector<vec2> pFilm(4096);
+    for (auto& p : pFilm)
+        p = vec2(rng.Uniformf(), rng.Uniformf());
+
+    Bench("Film.AddSample", [&](int64_t n) {
+        for (int64_t i = 0; i < n; i++)
+            film.AddSample(pFilm[i & 4095], Spectrum(vec3(0.5f)));
+    });
+}
+
+static void TextureAndMediumBenchmarks() {
+    RNG rng(4);
+    pstd::vector<vec3> points(4096);
+    for (auto& p : points)
+        p = vec3(rng.Uniformf(), rng.Uniformf(), rng.Uniformf());
+
+    Bench("PerlinNoise", [&](int64_t n) {
+        float sum = 0.0f;
+        for (int64_t i = 0; i < n; i++)
+            sum += PerlinNoise(points[i & 4095], 8.0f);
+        sink = sum;
+    });
+
+    vec3i size(64);
+    auto density = pstd::make_shared<pstd::vector<float>>(Volume(size));
+    for (auto& d : *density)
+        d = rng.Uniformf();
+    GridMedium medium(Spectrum(0.5f), Spectrum(0.5f), PhaseFunction(0.0f), size, vec3(0.0f), 1.0f,
+                      density, true, GridMedium::SamplingMethod::DeltaTracking, 1.0f);
+    Bench("GridMedium.Density", [&](int64_t n) {
+        float sum = 0.0f;
+        for (int64_t i = 0; i < n; i++)
+            sum += medium.Density(points[i & 4095]);
+        sink = sum;
+    });
+}
+
+static void SpectrumBenchmarks() {
+    RNG rng(5);
+    pstd::vector<vec3> colors(1024);
+    for (auto& c : colors)
+        c = vec3(rng.Uniformf(), rng.Uniformf(), rng.Uniformf());
+
+    Bench("SampledSpectrum.FromRGB", [&](int64_t n) {
+        float sum = 0.0f;
+        for (int64_t i = 0; i < n; i++)
+            sum += SampledSpectrum(colors[i & 1023])[0];
+        sink = sum;
+    });
+    SampledSpectrum a(colors[0]), b(colors[1]);
+    Bench("SampledSpectrum.MultiplyAdd", [&](int64_t n) {
+        SampledSpectrum s = a;
+        for (int64_t i = 0; i < n; i++)
+            s = s * b + a;
+        sink = s[0];
+    });
+    Bench("SampledSpectrum.ToRGB", [&](int64_t n) {
+        float sum = 0.0f;
+        for (int64_t i = 0; i < n; i++)
+            sum += SampledSpectrum(a * float(i & 7)).ToRGB().x;
+        sink = sum;
+    });
+    Bench("Spectrum.MultiplyAdd", [&](int64_t n) {
+        Spectrum s(colors[0]), c(colors[1]);
+        for (int64_t i = 0; i < n; i++)
+            s = s * c + Spectrum(colors[i & 1023]);
+        sink = s[0];
+    });
+}
+
+// Binary search of the CDF against the alias table, on a skewed distribution
+static void DistributionBenchmarks() {
+    RNG rng(6);
+    pstd::vector<float> func(512 * 256);
+    for (auto& f : func)
+        f = pstd::pow(rng.Uniformf(), 8.0f);
+    pstd::vector<float> us(4096);
+    for (auto& u : us)
+        u = rng.Uniformf();
+
+    Distribution1D distr1d(&func[0], 4096);
+    Bench("Distribution1D.SampleDiscrete", [&](int64_t n) {
+        float p, sum = 0.0f;
+        for (int64_t i = 0; i < n; i++)
+            sum += distr1d.SampleDiscrete(us[i & 4095], p);
+        sink = sum;
+    });
+    Bench("Distribution1D.SampleDiscreteAlias", [&](int64_t n) {
+        float p, sum = 0.0f;
+        for (int64_t i = 0; i < n; i++)
+            sum += distr1d.SampleDiscreteAlias(us[i & 4095], p);
+        sink = sum;
+    });
+
+    Distribution2D distr2d(&func[0], 512, 256);
+    Bench("Distribution2D.SampleContinuous", [&](int64_t n) {
+        float pdf, sum = 0.0f;
+        for (int64_t i = 0; i < n; i++)
+            sum += distr2d.SampleContinuous(vec2(us[i & 4095], us[(i + 1) & 4095]), pdf).x;
+        sink = sum;
+    });
+    Bench("Distribution2D.SampleContinuousAlias", [&](int64_t n) {
+        float pdf, sum = 0.0f;
+        for (int64_t i = 0; i < n; i++)
+            sum += distr2d.SampleContinuousAlias(vec2(us[i & 4095], us[(i + 1) & 4095]), pdf).x;
+        sink = sum;
+    });
+}
+
+// Casts camera rays and one cosine-weighted bounce per hit against a procedurally generated
+// scene on all threads; reports millions of rays per second
+static void SceneBenchmark(pstd::string name, const pstd::string& description) {
+    if (!Selected(name))
+        return;
+    Scene scene;
+    Parameters params = Parse(description);
+    for (auto& p : params.GetAll("Shape"))
+        scene.shapes.push_back(CreateShape(p, &scene));
+    pstd::unique_ptr<Accel> accel(CreateAccel({}));
+    accel->Initialize(&scene);
+
+    vec2i size(512, 512);
+    vec3 from(0.0f, 6.0f, 12.0f);
+    mat3 frame = CoordinateSystem(Normalize(-from));
+    pstd::vector<int64_t> rays(NumThreads());
+    auto trace = [&]() {
+        ParallelFor(size, [&](vec2i p) {
+            vec2 uv = (p + vec2(0.5f)) / size - vec2(0.5f);
+            Ray ray(from, Normalize(frame * vec3(uv.x, -uv.y, 1.0f)));
+            Interaction it;
+            rays[threadIdx]++;
+            if (!accel->Intersect(ray, it))
+                return;
+            vec2 u(Hashf(p, 0), Hashf(p, 1));
+            Ray bounce = it.SpawnRay(CoordinateSystem(it.n) * CosineWeightedSampling(u));
+            rays[threadIdx]++;
+            accel->Hit(bounce);
+        });
+    };
+
+    trace();
+    double best = Infinity;
+    int64_t nRays = 0;
+    for (int i = 0; i < 5; i++) {
+        pstd::fill(rays, 0);
+        Timer timer;
+        trace();
+        best = pstd::min(best, timer.ElapsedMs());
+        nRays = 0;
+        for (int64_t r : rays)
+            nRays += r;
+    }
+    double mrays = nRays / best / 1000.0;
+    LOG("[Bench]& &.3 Mrays/s", name, mrays);
+    results.push_back({name, "Mrays/s", mrays, nRays});
+}
+
+static pstd::string SpheresScene() {
+    pstd::string scene = "Shape: Plane{\nposition: 0 0 0\nnormal: 0 1 0\n}\n";
+    for (int x = -16; x < 16; x++)
+        for (int z = -16; z < 16; z++)
+            scene += pstd::to_string("Shape: Sphere{\nposition: ", x * 0.5f + 0.25f, " ",
+                                     0.25f + Hashf(x, z) * 0.5f, " ", z * 0.5f + 0.25f,
+                                     "\nradius: 0.2\n}\n");
+    return scene;
+}
+static pstd::string MeshScene() {
+    // A displaced height field of 2 * 128 * 128 triangles written as an obj file
+    pstd::string obj;
+    int n = 128;
+    for (int y = 0; y <= n; y++)
+        for (int x = 0; x <= n; x++)
+            obj += pstd::to_string("v ", 8.0f * x / n - 4.0f, " ",
+                                   PerlinNoise(vec3(x, y, 0) / n, 4.0f), " ", 8.0f * y / n - 4.0f,
+                                   "\n");
+    for (int y = 0; y < n; y++)
+        for (int x = 0; x < n; x++) {
+            int i = y * (n + 1) + x + 1;
+            obj += pstd::to_string("f ", i, " ", i + 1, " ", i + n + 2, "\n");
+            obj += pstd::to_string("f ", i, " ", i + n + 2, " ", i + n + 1, "\n");
+        }
+    WriteBinaryData("pine_bench_mesh.obj", obj.data(), obj.size());
+    return "Shape: TriangleMesh{\nfile: pine_bench_mesh.obj\n}\n";
+}
+
+static void WriteJSON(pstd::string_view filename) {
+    pstd::string json = pstd::to_string("{\n  \"threads\": ", NumThreads(), ",\n  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); i++)
+        json += pstd::to_string("    {\"name\": \"", results[i].name, "\", \"unit\": \"",
+                                results[i].unit, "\", \"value\": ", results[i].value,
+                                ", \"iterations\": ", results[i].iterations, "}",
+                                i + 1 == results.size() ? "\n" : ",\n");
+    json += "  ]\n}\n";
+    WriteBinaryData(filename, json.data(), json.size());
+    LOG("[Bench]Results written to \"&\"", filename);
+}
+
+int main(int argc, char* argv[]) {
+    pstd::string json;
+    for (int i = 1; i < argc; i++) {
+        if (pstd::string(argv[i]) == "--json" && i + 1 < argc)
+            json = argv[++i];
+        else
+            filter = argv[i];
+    }
+    if (filter == "--help") {
+        LOG("Usage: pine_bench [--json filename] [name prefix]");
+        return 0;
+    }
+
+    SampledSpectrum::Initialize();
+
+    GeometryBenchmarks();
+    SamplerBenchmarks();
+    FilmBenchmarks();
+    TextureAndMediumBenchmarks();
+    SpectrumBenchmarks();
+    DistributionBenchmarks();
+    SceneBenchmark("Scene.Spheres", SpheresScene());
+    if (Selected("Scene.Mesh"))
+        SceneBenchmark("Scene.Mesh", MeshScene());
+
+    if (json.size())
+        WriteJSON(json);
+
+    return 0;
+}